@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/ext.hpp>
+
+#include "Camera.h"
+#include "OrbitCamera.h"
+
+// A sequence of camera poses, recorded from the app or generated, to replay
+// the same views in the headless driver.
+//
+// Stored as text, one frame per line: the fov in degrees followed by the
+// 16 floats of the camera's world matrix, column by column.
+struct CameraPath {
+    struct Frame {
+        glm::mat4 world{1.0f};
+        float fov{45.0f};
+    };
+
+    std::vector<Frame> frames;
+
+    void record(const Camera &camera) {
+        frames.push_back({camera.worldMatrix, camera.fov});
+    }
+
+    // poses the camera like frame i, the aspect ratio is kept
+    void apply(size_t i, Camera &camera) const {
+        camera.worldMatrix = frames[i].world;
+        camera.fov = frames[i].fov;
+    }
+
+    bool save(const std::string &path) const {
+        std::ofstream file(path);
+        if (!file.is_open()) {
+            return false;
+        }
+        file << "# fov, world matrix by columns" << std::endl;
+        file.precision(9);
+        for (const auto &frame : frames) {
+            file << frame.fov;
+            for (int c = 0; c < 4; c++) {
+                for (int r = 0; r < 4; r++) {
+                    file << " " << frame.world[c][r];
+                }
+            }
+            file << std::endl;
+        }
+        return true;
+    }
+
+    bool load(const std::string &path) {
+        std::ifstream file(path);
+        if (!file.is_open()) {
+            return false;
+        }
+        frames.clear();
+        std::string line;
+        while (std::getline(file, line)) {
+            if (line.empty() || line[0] == '#') {
+                continue;
+            }
+            std::istringstream stream(line);
+            Frame frame;
+            stream >> frame.fov;
+            for (int c = 0; c < 4; c++) {
+                for (int r = 0; r < 4; r++) {
+                    stream >> frame.world[c][r];
+                }
+            }
+            if (!stream) {
+                return false;
+            }
+            frames.push_back(frame);
+        }
+        return true;
+    }
+
+    // count frames of an OrbitCamera turning around the origin, moving from
+    // distance_begin to distance_end so that the cuts see every level
+    static CameraPath orbit(size_t count, float distance_begin,
+            float distance_end, float pitch = 0.0f, float turns = 1.0f,
+            float fov = 45.0f) {
+        CameraPath path;
+        for (size_t i = 0; i < count; i++) {
+            float t = count > 1 ? static_cast<float>(i) / (count - 1) : 0.0f;
+            OrbitCamera orbit(glm::mix(distance_begin, distance_end, t));
+            orbit.rotate(glm::vec3(0.0f, 1.0f, 0.0f),
+                glm::two_pi<float>() * turns * t);
+            orbit.rotate(orbit.rotation[0], glm::radians(pitch));
+            orbit.camera->fov = fov;
+            orbit.updateWorldMatrix(glm::mat4(1.0f));
+            path.record(*orbit.camera);
+        }
+        return path;
+    }
+};
@@ -0,0 +1,322 @@
+#include "ClusterLOD.hpp"
+
+#include <iostream>
+#include <algorithm>
+#include <array>
+#include <queue>
+#include <utility>
+
+#ifdef PARALLEL
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#endif
+
+#include "HC.hpp"
+#include "Profiler.hpp"
+
+namespace {
+
+// spread the low 10 bits of v to every third bit
+uint32_t spread(uint32_t v) {
+    v &= 0x3ff;
+    v = (v | v << 16) & 0x30000ff;
+    v = (v | v << 8) & 0x300f00f;
+    v = (v | v << 4) & 0x30c30c3;
+    v = (v | v << 2) & 0x9249249;
+    return v;
+}
+
+// order of the positions along a Morton curve over their bounds
+std::vector<uint32_t> morton_order(const std::vector<glm::vec3> &positions) {
+    glm::vec3 min(std::numeric_limits<float>::max());
+    glm::vec3 max(std::numeric_limits<float>::lowest());
+    for (const auto &position : positions) {
+        min = glm::min(min, position);
+        max = glm::max(max, position);
+    }
+    glm::vec3 scale = 1023.0f / glm::max(max - min, glm::vec3(1e-12f));
+
+    std::vector<std::pair<uint32_t, uint32_t>> keyed(positions.size());
+    for (uint32_t i = 0; i < positions.size(); i++) {
+        glm::uvec3 cell = glm::clamp(
+            (positions[i] - min) * scale, glm::vec3(0.0f), glm::vec3(1023.0f));
+        keyed[i] = {spread(cell.x) << 2 | spread(cell.y) << 1 | spread(cell.z), i};
+    }
+    std::sort(keyed.begin(), keyed.end());
+
+    std::vector<uint32_t> order(positions.size());
+    for (uint32_t i = 0; i < keyed.size(); i++) {
+        order[i] = keyed[i].second;
+    }
+    return order;
+}
+
+// sphere around the 3 sigma extents of the splats
+glm::vec4 splat_bounds(const Splat *first, const Splat *last) {
+    glm::vec3 min(std::numeric_limits<float>::max());
+    glm::vec3 max(std::numeric_limits<float>::lowest());
+    for (const Splat *splat = first; splat != last; splat++) {
+        const auto &t = splat->transform;
+        glm::vec3 position(t[3]);
+        glm::vec3 extent = 3.0f * glm::sqrt(
+            glm::max(glm::vec3(t[0][0], t[1][1], t[2][2]), 0.0f));
+        min = glm::min(min, position - extent);
+        max = glm::max(max, position + extent);
+    }
+    return glm::vec4((min + max) * 0.5f, glm::length(max - min) * 0.5f);
+}
+
+// sphere containing all the given spheres
+glm::vec4 sphere_bounds(const std::vector<glm::vec4> &spheres) {
+    glm::vec3 min(std::numeric_limits<float>::max());
+    glm::vec3 max(std::numeric_limits<float>::lowest());
+    for (const auto &sphere : spheres) {
+        min = glm::min(min, glm::vec3(sphere) - sphere.w);
+        max = glm::max(max, glm::vec3(sphere) + sphere.w);
+    }
+    return glm::vec4((min + max) * 0.5f, glm::length(max - min) * 0.5f);
+}
+
+} // namespace
+
+void ClusterLOD::add_clusters(const Splat *first, const Splat *last,
+        uint32_t level, glm::vec4 lod_bounds, float error) {
+    size_t n = last - first;
+    std::vector<glm::vec3> positions(n);
+    for (size_t i = 0; i < n; i++) {
+        positions[i] = glm::vec3(first[i].transform[3]);
+    }
+    auto order = morton_order(positions);
+
+    // as many clusters as needed, all of about the same size
+    size_t count = (n + params.cluster_size - 1) / params.cluster_size;
+    for (size_t c = 0; c < count; c++) {
+        size_t begin = n * c / count;
+        size_t end = n * (c + 1) / count;
+        Cluster cluster;
+        cluster.range = {static_cast<uint32_t>(splats.size()),
+            static_cast<uint32_t>(splats.size() + end - begin)};
+        for (size_t i = begin; i < end; i++) {
+            splats.push_back(first[order[i]]);
+        }
+        cluster.level = level;
+        cluster.bounds = splat_bounds(splats.data() + cluster.range.begin,
+            splats.data() + cluster.range.end);
+        cluster.lod_bounds = lod_bounds;
+        cluster.error = error;
+        clusters.push_back(cluster);
+    }
+}
+
+SplatVector ClusterLOD::simplify(
+        const std::vector<uint32_t> &group, float &error) const {
+    SplatVector group_splats;
+    float child_error{0.0f};
+    for (auto c : group) {
+        const auto &cluster = clusters[c];
+        group_splats.insert(group_splats.end(),
+            splats.begin() + cluster.range.begin,
+            splats.begin() + cluster.range.end);
+        child_error = std::max(child_error, cluster.error);
+    }
+
+    HC hc;
+    hc.build(std::move(group_splats), false);
+
+    // refine from the roots to half the splats, always splitting the node
+    // with the largest error
+    size_t target = std::max<size_t>(1, hc.leaf_count / 2);
+    std::priority_queue<std::pair<float, uint32_t>> cut;
+    for (auto root : hc.roots) {
+        cut.push({hc.nodes[root].error, root});
+    }
+    while (cut.size() < target && !hc.nodes[cut.top().second].is_leaf()) {
+        const auto &node = hc.nodes[cut.top().second];
+        cut.pop();
+        for (auto child : node.children) {
+            cut.push({hc.nodes[child].error, child});
+        }
+    }
+
+    // errors only grow towards the top so that the levels nest
+    error = std::max(child_error, cut.top().first);
+    SplatVector simplified;
+    simplified.reserve(cut.size());
+    while (!cut.empty()) {
+        simplified.push_back(hc.splats[cut.top().second]);
+        cut.pop();
+    }
+    return simplified;
+}
+
+void ClusterLOD::build(const GridHC &gridhc) {
+    PROFILE_ZONE("cluster build");
+    clusters.clear();
+    splats.clear();
+
+    // every level has about half the splats of the one below, reserve
+    // for all of them instead of leaving the slack of doubling
+    size_t leaves{0};
+    for (const auto &cell : gridhc.cells) {
+        leaves += cell->hc.leaf_count;
+    }
+    splats.reserve(2 * leaves);
+
+    // level 0, the cells already are spatially compact
+    for (uint32_t c = 0; c < gridhc.cells.size(); c++) {
+        add_clusters(gridhc.cell_begin(c), gridhc.cell_end(c), 0,
+            glm::vec4(0.0f), 0.0f);
+    }
+    for (auto &cluster : clusters) {
+        cluster.lod_bounds = cluster.bounds;
+    }
+
+    uint32_t level_begin{0};
+    uint32_t level_end = clusters.size();
+    for (uint32_t level = 1; level_end - level_begin > 1; level++) {
+        // group neighbouring clusters along a Morton curve
+        std::vector<glm::vec3> positions;
+        for (uint32_t c = level_begin; c < level_end; c++) {
+            positions.push_back(glm::vec3(clusters[c].lod_bounds));
+        }
+        auto order = morton_order(positions);
+        std::vector<std::vector<uint32_t>> groups;
+        for (size_t i = 0; i < order.size(); i++) {
+            if (i % params.group_size == 0) {
+                groups.emplace_back();
+            }
+            groups.back().push_back(level_begin + order[i]);
+        }
+
+        std::vector<SplatVector> simplified(groups.size());
+        std::vector<float> errors(groups.size());
+        auto simplify_group = [&](size_t g) {
+            simplified[g] = simplify(groups[g], errors[g]);
+        };
+#ifdef PARALLEL
+        tbb::parallel_for(size_t(0), groups.size(), simplify_group);
+#else
+        for (size_t g = 0; g < groups.size(); g++) {
+            simplify_group(g);
+        }
+#endif
+
+        for (size_t g = 0; g < groups.size(); g++) {
+            std::vector<glm::vec4> spheres;
+            for (auto c : groups[g]) {
+                spheres.push_back(clusters[c].lod_bounds);
+            }
+            glm::vec4 group_bounds = sphere_bounds(spheres);
+            for (auto c : groups[g]) {
+                clusters[c].parent_bounds = group_bounds;
+                clusters[c].parent_error = errors[g];
+            }
+            add_clusters(simplified[g].data(),
+                simplified[g].data() + simplified[g].size(), level,
+                group_bounds, errors[g]);
+            SplatVector().swap(simplified[g]);
+        }
+
+        level_begin = level_end;
+        level_end = clusters.size();
+    }
+
+    own.resize(clusters.size());
+    parent.resize(clusters.size());
+    culling.resize(clusters.size());
+    for (size_t i = 0; i < clusters.size(); i++) {
+        const auto &cluster = clusters[i];
+        own.set(i, cluster.lod_bounds, cluster.error);
+        parent.set(i, cluster.parent_bounds, cluster.parent_error);
+        culling.set(i, cluster.bounds, 0.0f);
+    }
+
+    std::cout << "ClusterLOD: Built " << clusters.size() << " clusters in "
+              << (clusters.empty() ? 0 : clusters.back().level + 1)
+              << " levels with " << splats.size() << " splats." << std::endl;
+}
+
+Ranges ClusterLOD::get_ranges(Camera::Ptr camera, float threshold) {
+    glm::mat4 view_proj =
+        camera->getProjectionMatrix() * camera->getViewMatrix();
+    glm::vec3 eye = glm::vec3(camera->worldMatrix[3]);
+    float near = camera->near;
+
+    // frustum planes from the rows of the view projection
+    std::array<glm::vec4, 6> planes;
+    for (int axis = 0; axis < 3; axis++) {
+        glm::vec4 row(view_proj[0][axis], view_proj[1][axis],
+            view_proj[2][axis], view_proj[3][axis]);
+        glm::vec4 w(view_proj[0][3], view_proj[1][3],
+            view_proj[2][3], view_proj[3][3]);
+        planes[2 * axis] = w + row;
+        planes[2 * axis + 1] = w - row;
+    }
+    for (auto &plane : planes) {
+        plane /= glm::length(glm::vec3(plane));
+    }
+
+    // every cluster is tested on its own, branch free over the arrays so
+    // that the loop vectorizes
+    selected.resize(clusters.size());
+    auto select = [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            float dx = own.x[i] - eye.x;
+            float dy = own.y[i] - eye.y;
+            float dz = own.z[i] - eye.z;
+            float own_dist = std::sqrt(dx * dx + dy * dy + dz * dz) - own.radius[i];
+            float own_error = own.error[i] / std::max(own_dist, near);
+
+            dx = parent.x[i] - eye.x;
+            dy = parent.y[i] - eye.y;
+            dz = parent.z[i] - eye.z;
+            float parent_dist = std::sqrt(dx * dx + dy * dy + dz * dz) - parent.radius[i];
+            float parent_error = parent.error[i] / std::max(parent_dist, near);
+
+            bool visible{true};
+            for (const auto &plane : planes) {
+                visible &= plane.x * culling.x[i] + plane.y * culling.y[i]
+                    + plane.z * culling.z[i] + plane.w > -culling.radius[i];
+            }
+            selected[i] = visible && own_error <= threshold
+                && parent_error > threshold;
+        }
+    };
+#ifdef PARALLEL
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, clusters.size(), 4096),
+        [&](const tbb::blocked_range<size_t> &range) {
+            select(range.begin(), range.end());
+        });
+#else
+    select(0, clusters.size());
+#endif
+
+    Ranges ranges;
+    for (size_t i = 0; i < clusters.size(); i++) {
+        if (selected[i]) {
+            push_range(ranges, clusters[i].range);
+        }
+    }
+    return ranges;
+}
+
+Indices ClusterLOD::get_indices(Camera::Ptr camera, float threshold) {
+    Ranges ranges = get_ranges(camera, threshold);
+    Indices indices = ranges_to_indices(ranges);
+    PROFILE_COUNTER("cluster ranges", ranges.size());
+    return indices;
+}
+
+MemoryUsage ClusterLOD::memory_usage() const {
+    MemoryUsage usage;
+    usage.add("cluster clusters", clusters);
+    for (const auto *spheres : {&own, &parent, &culling}) {
+        for (const auto *field : {&spheres->x, &spheres->y, &spheres->z,
+                &spheres->radius, &spheres->error}) {
+            usage.add("cluster spheres", *field);
+        }
+    }
+    usage.add("cluster selected", selected);
+    usage.add("cluster splats", splats);
+    return usage;
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <limits>
+
+#include "Splat.h"
+#include "Camera.h"
+#include "GridHC.hpp"
+#include "Memory.hpp"
+
+// Cluster hierarchy in the style of Nanite. Every cluster is a contiguous
+// range of up to cluster_size splats. Clusters of one level are simplified
+// in groups of group_size into half as many splats, which are split into
+// the clusters of the next level.
+//
+// A cluster is drawn when the error of the group it was created in is
+// within the threshold but the error of the group it is simplified in is
+// not. Both errors are projected from the bounds of their group, so every
+// cluster is tested on its own and a whole level of the hierarchy is
+// replaced consistently.
+class ClusterLOD {
+public:
+    struct Params {
+        uint32_t cluster_size{128};
+        uint32_t group_size{4};
+    };
+
+    struct Cluster {
+        Range range;
+        uint32_t level{0};
+        // bounding sphere of the cluster's splats, for culling
+        glm::vec4 bounds{0.0f};
+        // sphere and error of the group the cluster was created in
+        glm::vec4 lod_bounds{0.0f};
+        float error{0.0f};
+        // sphere and error of the group the cluster is simplified in,
+        // infinite for the top level
+        glm::vec4 parent_bounds{0.0f};
+        float parent_error{std::numeric_limits<float>::infinity()};
+    };
+
+private:
+    // the fields tested per frame, one array each
+    struct Spheres {
+        std::vector<float> x, y, z, radius, error;
+
+        void resize(size_t size) {
+            for (auto *field : {&x, &y, &z, &radius, &error}) {
+                field->resize(size);
+            }
+        }
+        void set(size_t i, glm::vec4 sphere, float value) {
+            x[i] = sphere.x;
+            y[i] = sphere.y;
+            z[i] = sphere.z;
+            radius[i] = sphere.w;
+            error[i] = value;
+        }
+    };
+
+public:
+    Params params;
+    std::vector<Cluster> clusters;
+    SplatVector splats;
+
+private:
+    Spheres own;
+    Spheres parent;
+    Spheres culling;
+    std::vector<uint8_t> selected;
+
+public:
+    ClusterLOD() = default;
+    ClusterLOD(const Params &params) : params(params) {}
+
+    // level 0 holds the splats of every GridHC cell in clusters
+    void build(const GridHC &gridhc);
+
+    Ranges get_ranges(Camera::Ptr camera, float threshold);
+    Indices get_indices(Camera::Ptr camera, float threshold);
+
+    // the clusters, their splats and the per frame culling arrays, not the
+    // GridHC it was built from
+    MemoryUsage memory_usage() const;
+
+private:
+    // split [first, last) into balanced clusters of the given level,
+    // appending them and their splats
+    void add_clusters(const Splat *first, const Splat *last, uint32_t level,
+        glm::vec4 lod_bounds, float error);
+
+    // simplify the clusters of a group to half as many splats, returns
+    // the splats and the error of the simplification
+    SplatVector simplify(
+        const std::vector<uint32_t> &group, float &error) const;
+};
@@ -0,0 +1,586 @@
+#include "CpuRasterizer.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+
+#ifdef PARALLEL
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#endif
+
+#include "SplatBatch.hpp"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CPU_RASTERIZER_X86
+#include <immintrin.h>
+#endif
+
+namespace {
+
+constexpr int32_t T = CpuRasterizer::TILE_SIZE;
+// columns are shaded in aligned groups of 8 by every instruction set, so
+// that all of them touch exactly the same pixels
+constexpr int32_t GROUP = 8;
+// splats shaded between two checks for a saturated tile
+constexpr size_t SATURATION_INTERVAL = 16;
+
+// a splat after the vertex shader, as a parallelogram on the screen
+struct Projected {
+    // pixel position of the center
+    float cx, cy;
+    // maps the offset of a pixel from the center to the uv of the quad
+    float m00, m01, m10, m11;
+    glm::vec4 color;
+    // pixels the parallelogram may cover, clamped to the image
+    int32_t x_begin, x_end, y_begin, y_end;
+    // the instance index of the draw call, seeds the Bayer permutation
+    uint32_t instance;
+};
+
+enum class Mode {
+    // bayerSize 1, the Gaussian falloff
+    Smooth,
+    // bayerSize 10, opaque where the falloff exceeds bayerScale
+    Threshold,
+    // otherwise, an ordered dither of the falloff
+    Dither
+};
+
+struct Shading {
+    Mode mode;
+    float cut_off;
+    float bayer_scale;
+    // f32(bayerSize * bayerSize + 1)
+    float bayer_levels;
+    float min_transmittance;
+};
+
+struct TileBuffer {
+    int32_t x, y;
+    float center_x[T];
+    float center_y[T];
+    // accumulated color and transmittance per pixel
+    float r[T * T];
+    float g[T * T];
+    float b[T * T];
+    float t[T * T];
+    // bayerValue + 1 per permutation and pixel, for Mode::Dither
+    const float *dither;
+};
+
+bool saturated(const TileBuffer &tile, const Shading &shading) {
+    for (float t : tile.t) {
+        if (!(t < shading.min_transmittance)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// whether any fragment of a splat of opacity a can be visible, the falloff
+// never exceeds 1 so the dithered paths can skip faint splats entirely
+bool contributes(float a, const Shading &shading) {
+    switch (shading.mode) {
+    case Mode::Smooth:
+        break;
+    case Mode::Threshold:
+        return shading.bayer_scale < a;
+    case Mode::Dither:
+        return !(a * shading.bayer_scale * shading.bayer_levels < 1.0f);
+    }
+    return true;
+}
+
+// WGSL integer remainder, zero for a zero divisor
+uint32_t wgsl_mod(uint32_t a, uint32_t b) {
+    return b == 0 ? 0 : a % b;
+}
+
+// generate_permutation of the shader
+std::array<uint32_t, 4> generate_permutation(uint32_t state) {
+    uint32_t s = state;
+    std::array<uint32_t, 3> fac_state;
+    fac_state[0] = s / 6u;
+    s = s - fac_state[0] * 6u;
+    fac_state[1] = s / 2u;
+    s = s - fac_state[1] * 2u;
+    fac_state[2] = s;
+
+    std::array<uint32_t, 4> init_array{0, 1, 2, 3};
+    for (uint32_t i = 0; i < 3; i++) {
+        std::swap(init_array[i], init_array[fac_state[i] + i]);
+    }
+    return init_array;
+}
+
+// generate_bayer_value of the shader. Sizes that are not powers of two
+// index past init_array, where WGSL may return any element; clamped here
+// like the common implementations do.
+uint32_t generate_bayer_value(uint32_t x, uint32_t y, uint32_t bayer_size,
+        const std::array<uint32_t, 4> &init_array) {
+    uint32_t value = 0;
+    uint32_t current_size = bayer_size;
+    uint32_t current_x = x;
+    uint32_t current_y = y;
+    uint32_t k = 1;
+    while (current_size > 1u) {
+        current_size = current_size / 2u;
+        uint32_t cell_x = current_x / current_size;
+        uint32_t cell_y = current_y / current_size;
+        current_x = current_x % current_size;
+        current_y = current_y % current_size;
+        value = value + init_array[std::min(cell_x * 2u + cell_y, 3u)] * k;
+        k = k * 4u;
+    }
+    return value;
+}
+
+// bayerValue + 1 of the pixels of the tile at (x, y), for all permutations
+void fill_dither(std::vector<float> &dither, uint32_t bayer_size,
+        int32_t x, int32_t y) {
+    dither.resize(24 * T * T);
+    for (uint32_t state = 0; state < 24; state++) {
+        auto init_array = generate_permutation(state);
+        for (int32_t j = 0; j < T; j++) {
+            for (int32_t i = 0; i < T; i++) {
+                uint32_t value = generate_bayer_value(
+                    wgsl_mod(x + i, bayer_size), wgsl_mod(y + j, bayer_size),
+                    bayer_size, init_array);
+                dither[(state * T + j) * T + i] = static_cast<float>(value) + 1.0f;
+            }
+        }
+    }
+}
+
+// eigenvectors of the shader
+glm::mat2 eigenvectors(const glm::mat2 &a) {
+    float a11 = a[0][0];
+    float a22 = a[1][1];
+    float a1221 = a[0][1] * a[1][0];
+    float det = std::sqrt(a11 * a11 + 4.0f * a1221 - 2.0f * a11 * a22 + a22 * a22);
+    float lam1 = 0.5f * (a11 + a22 + det);
+    float lam2 = 0.5f * (a11 + a22 - det);
+    float phi = 0.5f * std::atan2(2.0f * a[0][1], a11 - a22);
+    return glm::mat2(
+        glm::vec2(std::cos(phi), std::sin(phi)) * std::sqrt(lam1),
+        glm::vec2(-std::sin(phi), std::cos(phi)) * std::sqrt(lam2));
+}
+
+// vs_main up to the screen, false if the quad is clipped or degenerate
+bool project(const Splat &splat, const glm::mat4 &wt,
+        const CpuRasterizer::Uniforms &uniforms, uint32_t width,
+        uint32_t height, Projected &out) {
+    glm::mat3 wt_xyz(wt);
+    glm::vec4 s_center = wt * splat.transform[3];
+    glm::mat3 s_rm(splat.transform);
+    glm::mat3 s_var_t = wt_xyz * s_rm * glm::transpose(wt_xyz);
+    glm::mat2 s_var_t_xy{glm::vec2(s_var_t[0]), glm::vec2(s_var_t[1])};
+    glm::mat2 s_var_proj = eigenvectors(s_var_t_xy);
+
+    // the quad only moves in view x and y, so for perspective and
+    // orthographic projections all corners share the center's depth and w
+    // and the quad is clipped as a whole
+    const glm::mat4 &proj = uniforms.projectionMatrix;
+    glm::vec4 clip = proj * s_center;
+    if (!(clip.w > 0.0f) || !(clip.z >= 0.0f && clip.z <= clip.w)) {
+        return false;
+    }
+
+    // pixel = center + jacobian * uv with uv = quadPosition * cutOff
+    glm::mat2 proj_xy{glm::vec2(proj[0]), glm::vec2(proj[1])};
+    glm::mat2 viewport(0.5f * width / clip.w, 0.0f, 0.0f, -0.5f * height / clip.w);
+    glm::mat2 jacobian = viewport * proj_xy * s_var_proj * uniforms.splatSize;
+    glm::mat2 inverse = glm::inverse(jacobian);
+    float cx = (clip.x / clip.w * 0.5f + 0.5f) * width;
+    float cy = (0.5f - clip.y / clip.w * 0.5f) * height;
+    for (float value : {inverse[0][0], inverse[0][1], inverse[1][0],
+            inverse[1][1], cx, cy}) {
+        if (!std::isfinite(value)) {
+            return false;
+        }
+    }
+
+    float k = uniforms.cutOff;
+    float extent_x = (std::abs(jacobian[0][0]) + std::abs(jacobian[1][0])) * k;
+    float extent_y = (std::abs(jacobian[0][1]) + std::abs(jacobian[1][1])) * k;
+    auto clamp = [](float value, uint32_t size) {
+        return static_cast<int32_t>(
+            std::clamp(value, 0.0f, static_cast<float>(size)));
+    };
+    out.x_begin = clamp(std::floor(cx - extent_x), width);
+    out.x_end = clamp(std::ceil(cx + extent_x), width);
+    out.y_begin = clamp(std::floor(cy - extent_y), height);
+    out.y_end = clamp(std::ceil(cy + extent_y), height);
+    if (out.x_begin >= out.x_end || out.y_begin >= out.y_end) {
+        return false;
+    }
+
+    out.cx = cx;
+    out.cy = cy;
+    out.m00 = inverse[0][0];
+    out.m01 = inverse[1][0];
+    out.m10 = inverse[0][1];
+    out.m11 = inverse[1][1];
+    out.color = splat.color;
+    return true;
+}
+
+// Cephes expf with plain multiplies and adds, evaluated identically by every
+// instruction set
+namespace cephes {
+constexpr float EXP_HI = 88.3762626647949f;
+constexpr float EXP_LO = -88.3762626647949f;
+constexpr float LOG2EF = 1.44269504088896341f;
+constexpr float C1 = 0.693359375f;
+constexpr float C2 = -2.12194440e-4f;
+constexpr float P0 = 1.9875691500e-4f;
+constexpr float P1 = 1.3981999507e-3f;
+constexpr float P2 = 8.3334519073e-3f;
+constexpr float P3 = 4.1665795894e-2f;
+constexpr float P4 = 1.6666665459e-1f;
+constexpr float P5 = 5.0000001201e-1f;
+} // namespace cephes
+
+namespace scalar {
+
+using V = float;
+using M = bool;
+constexpr size_t W = 1;
+
+inline V load(const float *p) {
+    return *p;
+}
+inline void store(float *p, V a) {
+    *p = a;
+}
+inline V vabs(V a) {
+    return std::fabs(a);
+}
+inline M vand(M a, M b) {
+    return a && b;
+}
+inline V select(M m, V a, V b) {
+    return m ? a : b;
+}
+inline M less(V a, V b) {
+    return a < b;
+}
+inline M less_equal(V a, V b) {
+    return a <= b;
+}
+
+inline V vexp(V x) {
+    using namespace cephes;
+    x = std::min(x, EXP_HI);
+    x = std::max(x, EXP_LO);
+    float fx = std::floor(x * LOG2EF + 0.5f);
+    x = x - fx * C1;
+    x = x - fx * C2;
+    float z = x * x;
+    float y = P0;
+    y = y * x + P1;
+    y = y * x + P2;
+    y = y * x + P3;
+    y = y * x + P4;
+    y = y * x + P5;
+    y = y * z + x;
+    y = y + 1.0f;
+    int32_t bits = (static_cast<int32_t>(fx) + 0x7f) << 23;
+    float pow2n;
+    std::memcpy(&pow2n, &bits, sizeof(float));
+    return y * pow2n;
+}
+
+#include "CpuRasterizerKernel.inl"
+
+} // namespace scalar
+
+#ifdef CPU_RASTERIZER_X86
+
+#if defined(__clang__)
+#pragma clang attribute push (__attribute__((target("avx2"))), apply_to = function)
+#else
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#endif
+
+namespace avx2 {
+
+struct V {
+    __m256 v;
+    V() = default;
+    V(__m256 v) : v(v) {}
+    V(float f) : v(_mm256_set1_ps(f)) {}
+};
+// all bits set in the lanes where the comparison holds
+using M = V;
+constexpr size_t W = 8;
+
+inline V operator+(V a, V b) {
+    return _mm256_add_ps(a.v, b.v);
+}
+inline V operator-(V a, V b) {
+    return _mm256_sub_ps(a.v, b.v);
+}
+inline V operator*(V a, V b) {
+    return _mm256_mul_ps(a.v, b.v);
+}
+
+inline V load(const float *p) {
+    return _mm256_loadu_ps(p);
+}
+inline void store(float *p, V a) {
+    _mm256_storeu_ps(p, a.v);
+}
+inline V vabs(V a) {
+    return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v);
+}
+inline M vand(M a, M b) {
+    return _mm256_and_ps(a.v, b.v);
+}
+inline V select(M m, V a, V b) {
+    return _mm256_blendv_ps(b.v, a.v, m.v);
+}
+inline M less(V a, V b) {
+    return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ);
+}
+inline M less_equal(V a, V b) {
+    return _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ);
+}
+
+inline V vexp(V a) {
+    using namespace cephes;
+    __m256 x = _mm256_min_ps(a.v, _mm256_set1_ps(EXP_HI));
+    x = _mm256_max_ps(x, _mm256_set1_ps(EXP_LO));
+    __m256 fx = _mm256_floor_ps(_mm256_add_ps(
+        _mm256_mul_ps(x, _mm256_set1_ps(LOG2EF)), _mm256_set1_ps(0.5f)));
+    x = _mm256_sub_ps(x, _mm256_mul_ps(fx, _mm256_set1_ps(C1)));
+    x = _mm256_sub_ps(x, _mm256_mul_ps(fx, _mm256_set1_ps(C2)));
+    __m256 z = _mm256_mul_ps(x, x);
+    __m256 y = _mm256_set1_ps(P0);
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(P1));
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(P2));
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(P3));
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(P4));
+    y = _mm256_add_ps(_mm256_mul_ps(y, x), _mm256_set1_ps(P5));
+    y = _mm256_add_ps(_mm256_mul_ps(y, z), x);
+    y = _mm256_add_ps(y, _mm256_set1_ps(1.0f));
+    __m256i bits = _mm256_slli_epi32(_mm256_add_epi32(
+        _mm256_cvttps_epi32(fx), _mm256_set1_epi32(0x7f)), 23);
+    return _mm256_mul_ps(y, _mm256_castsi256_ps(bits));
+}
+
+#include "CpuRasterizerKernel.inl"
+
+} // namespace avx2
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#else
+#pragma GCC pop_options
+#endif
+
+#endif // CPU_RASTERIZER_X86
+
+} // namespace
+
+bool CpuRasterizer::Image::write_ppm(const std::string &path) const {
+    std::ofstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        return false;
+    }
+    file << "P6\n" << width << " " << height << "\n255\n";
+    for (size_t i = 0; i < pixels.size(); i += 4) {
+        file.write(reinterpret_cast<const char *>(&pixels[i]), 3);
+    }
+    return static_cast<bool>(file);
+}
+
+bool CpuRasterizer::Image::read_ppm(const std::string &path) {
+    std::ifstream file(path, std::ios::binary);
+    std::string magic;
+    uint32_t max_value{0};
+    if (!(file >> magic >> width >> height >> max_value)
+            || magic != "P6" || max_value != 255) {
+        return false;
+    }
+    file.get();
+    pixels.assign(static_cast<size_t>(width) * height * 4, 255);
+    for (size_t i = 0; i < pixels.size(); i += 4) {
+        file.read(reinterpret_cast<char *>(&pixels[i]), 3);
+    }
+    return static_cast<bool>(file);
+}
+
+size_t CpuRasterizer::Image::count_differences(const Image &other) const {
+    if (width != other.width || height != other.height) {
+        return static_cast<size_t>(std::max(width, other.width))
+            * std::max(height, other.height);
+    }
+    size_t differences{0};
+    for (size_t i = 0; i < pixels.size(); i += 4) {
+        differences += std::memcmp(&pixels[i], &other.pixels[i], 4) != 0;
+    }
+    return differences;
+}
+
+CpuRasterizer::Image CpuRasterizer::render(const SplatVector &splats,
+        const Indices &sorted, const Uniforms &uniforms) {
+    stats = {};
+    uint32_t width = params.width;
+    uint32_t height = params.height;
+    uint32_t tiles_x = (width + T - 1) / T;
+    uint32_t tiles_y = (height + T - 1) / T;
+
+    Shading shading;
+    shading.mode = uniforms.bayerSize == 1 ? Mode::Smooth
+        : uniforms.bayerSize == 10 ? Mode::Threshold : Mode::Dither;
+    shading.cut_off = uniforms.cutOff;
+    shading.bayer_scale = uniforms.bayerScale;
+    shading.bayer_levels =
+        static_cast<float>(uniforms.bayerSize * uniforms.bayerSize + 1);
+    shading.min_transmittance = params.min_transmittance;
+
+    // vertex stage, one instance per sorted splat
+    glm::mat4 wt = uniforms.viewMatrix * uniforms.modelMatrix;
+    std::vector<Projected> projected(sorted.size());
+    std::vector<uint8_t> visible(sorted.size());
+    auto project_range = [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            const Splat &splat = splats[sorted[i]];
+            visible[i] = contributes(splat.color.a, shading)
+                && project(splat, wt, uniforms, width, height, projected[i]);
+            projected[i].instance = static_cast<uint32_t>(i);
+        }
+    };
+#ifdef PARALLEL
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, sorted.size(), 4096),
+        [&](const tbb::blocked_range<size_t> &range) {
+            project_range(range.begin(), range.end());
+        });
+#else
+    project_range(0, sorted.size());
+#endif
+
+    // bin the instances into the tiles they touch, front to back
+    std::vector<uint32_t> offsets(tiles_x * tiles_y + 1, 0);
+    auto for_each_tile = [&](const Projected &p, auto f) {
+        for (int32_t ty = p.y_begin / T; ty <= (p.y_end - 1) / T; ty++) {
+            for (int32_t tx = p.x_begin / T; tx <= (p.x_end - 1) / T; tx++) {
+                f(ty * tiles_x + tx);
+            }
+        }
+    };
+    for (size_t i = 0; i < projected.size(); i++) {
+        if (visible[i]) {
+            stats.projected++;
+            for_each_tile(projected[i], [&](uint32_t tile) {
+                offsets[tile + 1]++;
+            });
+        }
+    }
+    for (size_t tile = 0; tile + 1 < offsets.size(); tile++) {
+        offsets[tile + 1] += offsets[tile];
+    }
+    stats.binned = offsets.back();
+    std::vector<uint32_t> list(offsets.back());
+    std::vector<uint32_t> cursor(offsets.begin(), offsets.end() - 1);
+    for (size_t i = projected.size(); i-- > 0;) {
+        if (visible[i]) {
+            for_each_tile(projected[i], [&](uint32_t tile) {
+                list[cursor[tile]++] = static_cast<uint32_t>(i);
+            });
+        }
+    }
+
+    // the dither pattern repeats in every tile if its size divides the tile
+    uint32_t bayer_size = uniforms.bayerSize;
+    bool shared_dither = shading.mode == Mode::Dither
+        && (bayer_size == 0 || T % bayer_size == 0);
+    std::vector<float> dither;
+    if (shared_dither) {
+        fill_dither(dither, bayer_size, 0, 0);
+    }
+
+    auto shade_tile = simd_level() == SimdLevel::Scalar
+        ? &scalar::shade_tile :
+#ifdef CPU_RASTERIZER_X86
+        &avx2::shade_tile;
+#else
+        &scalar::shade_tile;
+#endif
+
+    Image image;
+    image.width = width;
+    image.height = height;
+    image.pixels.resize(static_cast<size_t>(width) * height * 4);
+    std::atomic<size_t> shaded{0};
+    std::atomic<size_t> saturated_tiles{0};
+
+    auto shade_range = [&](size_t begin, size_t end) {
+        TileBuffer tile;
+        std::vector<float> tile_dither;
+        for (size_t index = begin; index < end; index++) {
+            tile.x = static_cast<int32_t>(index % tiles_x) * T;
+            tile.y = static_cast<int32_t>(index / tiles_x) * T;
+            for (int32_t i = 0; i < T; i++) {
+                tile.center_x[i] = static_cast<float>(tile.x + i) + 0.5f;
+                tile.center_y[i] = static_cast<float>(tile.y + i) + 0.5f;
+            }
+            for (int32_t y = 0; y < T; y++) {
+                for (int32_t x = 0; x < T; x++) {
+                    size_t i = y * T + x;
+                    tile.r[i] = tile.g[i] = tile.b[i] = 0.0f;
+                    // pixels outside of the image count as saturated
+                    bool inside = tile.x + x < static_cast<int32_t>(width)
+                        && tile.y + y < static_cast<int32_t>(height);
+                    tile.t[i] = inside ? 1.0f : 0.0f;
+                }
+            }
+            if (shading.mode == Mode::Dither && !shared_dither) {
+                fill_dither(tile_dither, bayer_size, tile.x, tile.y);
+            }
+            tile.dither = shared_dither ? dither.data() : tile_dither.data();
+
+            size_t count = offsets[index + 1] - offsets[index];
+            size_t done = shade_tile(projected.data(),
+                list.data() + offsets[index], count, shading, tile);
+            shaded += done;
+            saturated_tiles += done < count;
+
+            // resolve against the clear color, alpha is never blended
+            int32_t x_end = std::min<int32_t>(T, width - tile.x);
+            int32_t y_end = std::min<int32_t>(T, height - tile.y);
+            for (int32_t y = 0; y < y_end; y++) {
+                for (int32_t x = 0; x < x_end; x++) {
+                    size_t i = y * T + x;
+                    glm::vec4 color(tile.r[i], tile.g[i], tile.b[i], 0.0f);
+                    color += tile.t[i] * params.clear_color;
+                    color.a = params.clear_color.a;
+                    uint8_t *pixel = &image.pixels[
+                        (static_cast<size_t>(tile.y + y) * width + tile.x + x) * 4];
+                    for (int c = 0; c < 4; c++) {
+                        pixel[c] = static_cast<uint8_t>(
+                            std::clamp(color[c], 0.0f, 1.0f) * 255.0f + 0.5f);
+                    }
+                }
+            }
+        }
+    };
+#ifdef PARALLEL
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, tiles_x * tiles_y),
+        [&](const tbb::blocked_range<size_t> &range) {
+            shade_range(range.begin(), range.end());
+        });
+#else
+    shade_range(0, tiles_x * tiles_y);
+#endif
+
+    stats.shaded = shaded;
+    stats.saturated_tiles = saturated_tiles;
+    return image;
+}
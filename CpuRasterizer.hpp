@@ -0,0 +1,83 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <string>
+#include <cstdint>
+
+#include "Splat.h"
+
+// CPU reference of shader_quads_ordered.wgsl. Every splat is projected with
+// the vertex shader's math into a screen aligned parallelogram and shaded
+// with the fragment shader's falloff, threshold and Bayer dither paths.
+//
+// The screen is split into tiles that are shaded independently, each one
+// walking its splats front to back so that it can stop once every pixel is
+// saturated. Front to back "under" blending gives the result of the
+// pipeline's back to front SrcAlpha / OneMinusSrcAlpha blending. Only the
+// instruction set, not the thread count, changes the work per pixel, and
+// every instruction set evaluates the same float operations, so images are
+// reproducible bit for bit.
+class CpuRasterizer {
+public:
+    static constexpr uint32_t TILE_SIZE = 16;
+
+    // the Uniforms of the shader
+    struct Uniforms {
+        glm::mat4 projectionMatrix{1.0f};
+        glm::mat4 viewMatrix{1.0f};
+        glm::mat4 modelMatrix{1.0f};
+        float splatSize{1.0f};
+        float cutOff{3.5f};
+        uint32_t bayerSize{1};
+        float bayerScale{1.0f};
+    };
+
+    struct Params {
+        uint32_t width{1000};
+        uint32_t height{800};
+        // a pixel stops blending once its transmittance is below this, the
+        // remaining splats can change it by at most half an 8 bit step
+        float min_transmittance{1.0f / 512.0f};
+        // the clear value of the render pass
+        glm::vec4 clear_color{0.05f, 0.05f, 0.05f, 1.0f};
+    };
+
+    // 8 bit RGBA as blended into the framebuffer, rows from the top
+    struct Image {
+        uint32_t width{0};
+        uint32_t height{0};
+        std::vector<uint8_t> pixels;
+
+        // binary PPM, alpha is dropped
+        bool write_ppm(const std::string &path) const;
+        bool read_ppm(const std::string &path);
+        // number of pixels that differ in any channel, all of them if the
+        // sizes differ
+        size_t count_differences(const Image &other) const;
+    };
+
+    struct Stats {
+        // splats that can be visible, inside the clip volume and with a
+        // valid projection
+        size_t projected{0};
+        // (splat, tile) pairs after binning
+        size_t binned{0};
+        // (splat, tile) pairs actually shaded
+        size_t shaded{0};
+        // tiles that stopped before their last splat
+        size_t saturated_tiles{0};
+    };
+
+    Params params;
+    Stats stats;
+
+public:
+    CpuRasterizer() = default;
+    CpuRasterizer(const Params &params) : params(params) {}
+
+    // draws splats[sorted[i]] as instance i, sorted back to front like the
+    // sort index buffer
+    Image render(const SplatVector &splats, const Indices &sorted,
+        const Uniforms &uniforms);
+};
@@ -0,0 +1,73 @@
+// Front to back shading of the splats of one tile, included once per
+// instruction set by CpuRasterizer.cpp. The including namespace provides the
+// lane type V, its mask type M, its width W and the helpers load, store,
+// vexp, vabs, vand, select, less and less_equal.
+
+// returns the number of splats shaded before every pixel saturated
+inline size_t shade_tile(const Projected *projected, const uint32_t *list,
+        size_t count, const Shading &shading, TileBuffer &tile) {
+    constexpr int32_t T = CpuRasterizer::TILE_SIZE;
+    V cut_off(shading.cut_off);
+    V min_transmittance(shading.min_transmittance);
+    V bayer_scale(shading.bayer_scale);
+    V bayer_levels(shading.bayer_levels);
+
+    for (size_t n = 0; n < count; n++) {
+        if (n % SATURATION_INTERVAL == 0 && saturated(tile, shading)) {
+            return n;
+        }
+        const Projected &p = projected[list[n]];
+
+        // rows and column groups the splat covers in this tile
+        int32_t row_begin = std::max(p.y_begin - tile.y, 0);
+        int32_t row_end = std::min(p.y_end - tile.y, T);
+        int32_t col_begin = std::max(p.x_begin - tile.x, 0) / GROUP * GROUP;
+        int32_t col_end =
+            (std::min(p.x_end - tile.x, T) + GROUP - 1) / GROUP * GROUP;
+
+        V cx(p.cx), cy(p.cy);
+        V m00(p.m00), m01(p.m01), m10(p.m10), m11(p.m11);
+        V r(p.color.r), g(p.color.g), b(p.color.b), a(p.color.a);
+        const float *dither = tile.dither + (p.instance % 24) * T * T;
+
+        for (int32_t y = row_begin; y < row_end; y++) {
+            V dy = V(tile.center_y[y]) - cy;
+            for (int32_t x = col_begin; x < col_end; x += static_cast<int32_t>(W)) {
+                size_t i = y * T + x;
+                V dx = load(tile.center_x + x) - cx;
+
+                // the interpolated uv of the quad
+                V u = m00 * dx + m01 * dy;
+                V v = m10 * dx + m11 * dy;
+                M covered = vand(less_equal(vabs(u), cut_off),
+                    less_equal(vabs(v), cut_off));
+
+                V dist = u * u + v * v;
+                V falloff = vexp(V(-0.5f) * dist);
+                V alpha = a * falloff;
+                switch (shading.mode) {
+                case Mode::Smooth:
+                    break;
+                case Mode::Threshold:
+                    alpha = select(less(bayer_scale, alpha), V(1.0f), V(0.0f));
+                    break;
+                case Mode::Dither:
+                    alpha = select(
+                        less(alpha * bayer_scale * bayer_levels, load(dither + i)),
+                        V(0.0f), V(1.0f));
+                    break;
+                }
+
+                V t = load(tile.t + i);
+                alpha = select(vand(covered, less_equal(min_transmittance, t)),
+                    alpha, V(0.0f));
+                V weight = t * alpha;
+                store(tile.r + i, load(tile.r + i) + weight * r);
+                store(tile.g + i, load(tile.g + i) + weight * g);
+                store(tile.b + i, load(tile.b + i) + weight * b);
+                store(tile.t + i, t * (V(1.0f) - alpha));
+            }
+        }
+    }
+    return count;
+}
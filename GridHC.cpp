@@ -4,108 +4,488 @@
 #include <glm/glm.hpp>
 #include <glm/ext.hpp>
 #include <string>
+#include <atomic>
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <numeric>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+
+#ifdef PARALLEL
+#include <tbb/task_group.h>
+#include <tbb/task_arena.h>
+#include <tbb/parallel_for.h>
+#include <tbb/parallel_sort.h>
+#endif
 
 #include "BB.hpp"
+#include "Profiler.hpp"
 
 void GridHC::build(SplatVector splats_init) {
-    float density = 4.0f;
-
-
+    PROFILE_ZONE("gridhc build");
     BB bb = BB::from_splats(splats_init, false);
     auto size = bb.size();
-    //subdivisions = static_cast<glm::uvec3>(glm::ceil(size * density));
     glm::vec3 cell_size = 1.1f * size / static_cast<glm::vec3>(subdivisions);
     glm::vec3 min = bb.min() - cell_size * (0.1f / 1.1f);
 
     std::cout << "GridHC: Bounding box built: " << min.x << ", " << min.y << ", " << min.z << std::endl;
 
-
-    
     cells.clear();
-    cells.resize(subdivisions.x * subdivisions.y * subdivisions.z);
     splats.clear();
-    splats.reserve(2 * splats_init.size());
 
+    // key every splat by its cell, clamped so that rounding at the border
+    // never drops a splat
+    Keyed keyed(splats_init.size());
+    glm::vec3 last_cell = static_cast<glm::vec3>(subdivisions - 1u);
+    auto bin = [&](size_t i) {
+        glm::vec3 position = glm::vec3(splats_init[i].transform[3]);
+        glm::vec3 cell = glm::clamp(
+            glm::floor((position - min) / cell_size), glm::vec3(0.0f), last_cell);
+        keyed[i] = {key(static_cast<glm::uvec3>(cell)), static_cast<uint32_t>(i)};
+    };
+#ifdef PARALLEL
+    tbb::parallel_for(size_t(0), keyed.size(), bin);
+    tbb::parallel_sort(keyed.begin(), keyed.end());
+#else
+    for (size_t i = 0; i < keyed.size(); i++) {
+        bin(i);
+    }
+    std::sort(keyed.begin(), keyed.end());
+#endif
+
+    // only occupied octree nodes become cells, each a run of keys
+    uint32_t root_level{0};
+    while ((1u << root_level) < glm::max(subdivisions.x,
+            glm::max(subdivisions.y, subdivisions.z))) {
+        root_level++;
+    }
+    std::vector<size_t> runs;
+    if (!keyed.empty()) {
+        partition(keyed, 0, keyed.size(), root_level, runs);
+    }
+    runs.push_back(keyed.size());
+    // Every cell gets a slot of splats with room for the nodes its HC can
+    // have, the HC is built in place and the slots are moved together
+    // afterwards. splats is allocated once, with room for the
+    // representatives of the blocks, at most two per cell.
+    std::vector<size_t> slots(cells.size() + 1, 0);
+    for (uint32_t c = 0; c < cells.size(); c++) {
+        slots[c + 1] = slots[c] + HC::node_capacity(runs[c + 1] - runs[c]);
+    }
+    splats.reserve(slots.back() + 2 * cells.size());
+    splats.resize(slots.back());
+    auto fill = [&](uint32_t c) {
+        for (size_t i = runs[c]; i < runs[c + 1]; i++) {
+            splats[slots[c] + i - runs[c]] = splats_init[keyed[i].second];
+        }
+    };
+#ifdef PARALLEL
+    tbb::parallel_for(uint32_t(0), static_cast<uint32_t>(cells.size()), fill);
+#else
+    for (uint32_t c = 0; c < cells.size(); c++) {
+        fill(c);
+    }
+#endif
 
-    std::cout << "GridHC: Building grid with " << cells.size() << " cells." << std::endl;
-    
-    for (uint32_t i = 0; i < subdivisions.x; i++) {
-        for (uint32_t j = 0; j < subdivisions.y; j++) {
-            for (uint32_t k = 0; k < subdivisions.z; k++) {
-                auto cell = std::make_shared<Cell>();
-                cells[get_index(i, j, k)] = cell;
+    std::cout << "GridHC: Distributed " << splats_init.size() << " splats into "
+              << cells.size() << " cells of at most " << max_cell_splats
+              << " splats on a " << subdivisions.x << "x" << subdivisions.y
+              << "x" << subdivisions.z << " grid." << std::endl;
+    // every splat is in its cell now
+    SplatVector().swap(splats_init);
+    Keyed().swap(keyed);
+
+    // cells are independent, build the largest ones first so that a big
+    // cell does not start last and stall the other threads
+    std::vector<uint32_t> order(cells.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        return runs[a + 1] - runs[a] > runs[b + 1] - runs[b];
+    });
+
+    std::vector<double> times(cells.size());
+    std::atomic<size_t> next{0};
+    auto worker = [&]() {
+        for (size_t i = next++; i < order.size(); i = next++) {
+            PROFILE_ZONE("gridhc cell build");
+            uint32_t c = order[i];
+            auto &cell = cells[c];
+            Splat *leaves = splats.data() + slots[c];
+            uint32_t count = runs[c + 1] - runs[c];
+
+            // the axis aligned extent of a 3 sigma ellipsoid is
+            // 3 * sqrt of the diagonal of its covariance
+            glm::vec3 cell_min(std::numeric_limits<float>::max());
+            glm::vec3 cell_max(std::numeric_limits<float>::lowest());
+            for (uint32_t j = 0; j < count; j++) {
+                const auto &t = leaves[j].transform;
+                glm::vec3 position(t[3]);
+                glm::vec3 extent = 3.0f * glm::sqrt(
+                    glm::max(glm::vec3(t[0][0], t[1][1], t[2][2]), 0.0f));
+                cell_min = glm::min(cell_min, position - extent);
+                cell_max = glm::max(cell_max, position + extent);
             }
+            cell->bb = BB::from_aabb(cell_min, cell_max);
+
+            auto start = std::chrono::steady_clock::now();
+            cell->hc.build(leaves, count, false);
+            times[c] = std::chrono::duration<double>(
+                std::chrono::steady_clock::now() - start).count();
         }
+    };
+#ifdef PARALLEL
+    tbb::task_group group;
+    for (int t = 0; t < tbb::this_task_arena::max_concurrency(); t++) {
+        group.run(worker);
     }
+    group.wait();
+#else
+    worker();
+#endif
 
-    for (const auto &splat : splats_init) {
-        glm::vec3 position = glm::vec3(splat.transform[3]);
-        uint32_t i = static_cast<uint32_t>((position.x - min.x) / cell_size.x);
-        uint32_t j = static_cast<uint32_t>((position.y - min.y) / cell_size.y);
-        uint32_t k = static_cast<uint32_t>((position.z - min.z) / cell_size.z);
-        
-        if (i < subdivisions.x && j < subdivisions.y && k < subdivisions.z) {
-            cells[get_index(i, j, k)]->splats.push_back(splat);
+    if (!cells.empty()) {
+        size_t max_splats{0};
+        double mean{0.0};
+        double max_time{0.0};
+        for (uint32_t i = 0; i < cells.size(); i++) {
+            max_splats = std::max<size_t>(max_splats, cells[i]->hc.leaf_count);
+            mean += times[i];
+            max_time = std::max(max_time, times[i]);
         }
-        else {
-            std::cerr << "Splat position out of bounds: "
-                      << "i: " << i << ", j: " << j << ", k: " << k
-                      << ". Splat will be ignored." << std::endl;
-            continue;
+        mean /= cells.size();
+        double variance{0.0};
+        for (auto time : times) {
+            variance += (time - mean) * (time - mean);
         }
+        variance /= cells.size();
+        std::cout << "GridHC: Built " << cells.size() << " cells, largest "
+                  << max_splats << " splats. Cell build time mean "
+                  << mean * 1000.0 << "ms, std dev "
+                  << std::sqrt(variance) * 1000.0 << "ms, max "
+                  << max_time * 1000.0 << "ms." << std::endl;
     }
 
-    std::cout << "GridHC: Distributed " << splats_init.size() << " splats into "
-              << cells.size() << " cells." << std::endl;
+    // the trees with several roots left room in their slots, move the
+    // cells together in order, no cell moves past its own slot. The
+    // representatives of the blocks follow within the reserved room.
+    offsets.assign(cells.size() + 1, 0);
+    for (uint32_t i = 0; i < cells.size(); i++) {
+        size_t size = cells[i]->hc.nodes.size();
+        offsets[i + 1] = offsets[i] + size;
+        if (offsets[i] != slots[i]) {
+            std::copy(splats.begin() + slots[i],
+                splats.begin() + slots[i] + size, splats.begin() + offsets[i]);
+        }
+    }
+    splats.resize(offsets.back());
+    SplatVector representatives = build_blocks();
+    splats.insert(splats.end(), representatives.begin(), representatives.end());
 
-    for (uint32_t i = 0; i < subdivisions.x * subdivisions.y * subdivisions.z; i++) {
-        auto cell = cells[i];
-        std::cout << "GridHC: Processing cell " << i << ", with "
-            << cell->splats.size() << "splats" << std::endl;
-        if (cell->empty()) {
-            continue;
+    std::cout << "GridHC: Built grid with " << splats.size() << " splats in "
+              << blocks.size() << " blocks." << std::endl;
+}
+
+namespace {
+
+// moment matched merge of weighted splats, added one at a time
+struct Accumulator {
+    Splat splat;
+    float weight{0.0f};
+    uint32_t count{0};
+    // index of the splat if only one was added
+    uint32_t id{0};
+
+    void add(const Splat &other, float other_weight, uint32_t other_id) {
+        if (count == 0) {
+            splat = other;
+            id = other_id;
+        } else {
+            float total = weight + other_weight;
+            splat = merge_splats(
+                splat, other, weight / total, other_weight / total);
         }
-        cell->hc.build(cell->splats, false);
-        splats.insert(
-            splats.end(), cell->hc.splats.begin(), cell->hc.splats.end());
+        weight += other_weight;
+        count++;
     }
+};
 
-    std::cout << "GridHC: Built grid with " << splats.size() << " splats." << std::endl;
+BB merge_bb(const BB &a, const BB &b) {
+    return BB::from_aabb(glm::min(a.min(), b.min()), glm::max(a.max(), b.max()));
 }
 
-Indices GridHC::get_indices_error(uint32_t depth, float error) {
-    Indices indices;
-    indices.reserve(splats.size());
-    uint32_t offset{0};
-    for (const auto &cell : cells) {
-        if (cell->empty()) {
-            continue;
+} // namespace
+
+void GridHC::partition(const Keyed &keyed, size_t begin, size_t end,
+        uint32_t level, std::vector<size_t> &runs) {
+    if (end - begin <= max_cell_splats || level == 0) {
+        runs.push_back(begin);
+        cells.push_back(std::make_shared<Cell>());
+        cells.back()->key = keyed[begin].first >> (3 * level);
+        cells.back()->level = level;
+        return;
+    }
+    // children are consecutive runs of the next three bits
+    uint32_t shift = 3 * (level - 1);
+    while (begin < end) {
+        uint64_t child = keyed[begin].first >> shift;
+        size_t child_end = std::partition_point(
+            keyed.begin() + begin, keyed.begin() + end,
+            [&](const std::pair<uint64_t, uint32_t> &item) {
+                return (item.first >> shift) == child;
+            }) - keyed.begin();
+        partition(keyed, begin, child_end, level - 1, runs);
+        begin = child_end;
+    }
+}
+
+SplatVector GridHC::build_blocks() {
+    blocks.clear();
+    SplatVector representatives;
+    if (cells.empty()) {
+        return representatives;
+    }
+
+    // store the representative, reusing the splat if nothing was merged.
+    // Blocks are finished in the order they are added, block_splats holds
+    // the representative of each until they are appended to splats.
+    SplatVector block_splats;
+    auto finish = [&](Block &block, const Accumulator &accumulator) {
+        block.weight = accumulator.weight;
+        if (accumulator.count == 1) {
+            block.splat = accumulator.id;
+        } else {
+            block.splat = offsets.back() + representatives.size();
+            representatives.push_back(accumulator.splat);
+        }
+        block_splats.push_back(accumulator.splat);
+    };
+
+    // a leaf per cell, merging the roots of the cell
+    for (uint32_t i = 0; i < cells.size(); i++) {
+        const auto &cell = cells[i];
+        blocks.emplace_back();
+        auto &block = blocks.back();
+        block.level = cell->level;
+        block.key = cell->key;
+        block.cell = i;
+        block.bb = cell->bb;
+        Accumulator accumulator;
+        for (auto root : cell->hc.roots) {
+            accumulator.add(cell_begin(i)[root],
+                cell->hc.nodes[root].weight, offsets[i] + root);
+        }
+        finish(block, accumulator);
+    }
+
+    // leaves enter at their own level, every level is merged with its
+    // siblings into the next one until a single block is left
+    std::vector<uint32_t> leaves(cells.size());
+    std::iota(leaves.begin(), leaves.end(), 0);
+    std::stable_sort(leaves.begin(), leaves.end(), [&](uint32_t a, uint32_t b) {
+        return blocks[a].level < blocks[b].level;
+    });
+    size_t next_leaf{0};
+    std::vector<uint32_t> current;
+    for (uint32_t level = 0; ; level++) {
+        while (next_leaf < leaves.size() &&
+                blocks[leaves[next_leaf]].level == level) {
+            current.push_back(leaves[next_leaf++]);
+        }
+        if (current.size() == 1 && next_leaf == leaves.size()) {
+            break;
         }
-        auto cell_indices = cell->hc.get_indices_depth(depth);
-        for (uint32_t i = 0; i < cell_indices.size(); i++) {
-            indices.push_back(cell_indices[i] + offset); 
+
+        std::sort(current.begin(), current.end(), [&](uint32_t a, uint32_t b) {
+            return blocks[a].key < blocks[b].key;
+        });
+        std::vector<uint32_t> parents;
+        for (size_t i = 0; i < current.size(); i++) {
+            uint64_t key = blocks[current[i]].key >> 3;
+            if (i == 0 || key != blocks[parents.back()].key) {
+                parents.push_back(blocks.size());
+                blocks.emplace_back();
+                blocks.back().level = level + 1;
+                blocks.back().key = key;
+            }
+            blocks.back().children.push_back(current[i]);
+        }
+        for (auto b : parents) {
+            auto &block = blocks[b];
+            Accumulator accumulator;
+            block.bb = blocks[block.children.front()].bb;
+            for (auto child : block.children) {
+                const auto &child_block = blocks[child];
+                block.bb = merge_bb(block.bb, child_block.bb);
+                accumulator.add(block_splats[child],
+                    child_block.weight, child_block.splat);
+            }
+            finish(block, accumulator);
         }
-        offset += cell->hc.splats.size();
-    }             
-    std::cout << "GridHC: Found " << indices.size() << " splats" << std::endl;
+        current = std::move(parents);
+    }
+    return representatives;
+}
+
+template <typename Write>
+Indices GridHC::collect(
+        const std::vector<uint32_t> &refined, Write write, Indices indices) {
+    // No cut of a cell is larger than its leaf count, so the prefix sum of
+    // the leaf counts gives every cell a slot it writes its cut straight
+    // into. The slots are then moved together, each by the room the cells
+    // before it left unused.
+    PROFILE_COUNTER("gridhc refined cells", refined.size());
+    std::vector<size_t> slots(refined.size() + 1, indices.size());
+    for (uint32_t i = 0; i < refined.size(); i++) {
+        slots[i + 1] = slots[i] + cells[refined[i]]->hc.leaf_count;
+    }
+    std::vector<size_t> counts(refined.size());
+
+    indices.resize(slots.back());
+    auto write_cell = [&](uint32_t i) {
+        PROFILE_ZONE("gridhc cell cut");
+        counts[i] = write(
+            refined[i], indices.data() + slots[i], offsets[refined[i]]);
+    };
+#ifdef PARALLEL
+    tbb::parallel_for(uint32_t(0), static_cast<uint32_t>(refined.size()), write_cell);
+#else
+    for (uint32_t i = 0; i < refined.size(); i++) {
+        write_cell(i);
+    }
+#endif
+
+    size_t end = slots.front();
+    for (uint32_t i = 0; i < refined.size(); i++) {
+        if (end != slots[i]) {
+            std::memmove(indices.data() + end, indices.data() + slots[i],
+                counts[i] * sizeof(uint32_t));
+        }
+        end += counts[i];
+    }
+    indices.resize(end);
     return indices;
 }
 
-Indices GridHC::get_indices(
-        Camera::Ptr camera, float threshold, HC::MetricWeights w) {
+GridHC::Visibility GridHC::visibility(const BB &bb,
+        const glm::mat4 &view_proj, float min_screen_area) {
+    auto bb_corners = bb.corners();
+    std::array<glm::vec4, 8> clip;
+    bool in_front{true};
+    for (int i = 0; i < 8; i++) {
+        clip[i] = view_proj * glm::vec4(bb_corners[i], 1.0f);
+        in_front = in_front && clip[i].w > 0.0f;
+    }
+
+    // culled if all corners lie beyond the same clip plane
+    for (int axis = 0; axis < 3; axis++) {
+        bool below{true};
+        bool above{true};
+        for (const auto &c : clip) {
+            below = below && c[axis] < -c.w;
+            above = above && c[axis] > c.w;
+        }
+        if (below || above) {
+            return Visibility::Culled;
+        }
+    }
+
+    // a box reaching behind the camera has no meaningful screen area
+    if (!in_front) {
+        return Visibility::Refined;
+    }
+    glm::vec2 min(std::numeric_limits<float>::max());
+    glm::vec2 max(std::numeric_limits<float>::lowest());
+    for (const auto &c : clip) {
+        auto ndc = glm::vec2(c) / c.w;
+        min = glm::min(min, ndc);
+        max = glm::max(max, ndc);
+    }
+    glm::vec2 size = max - min;
+    if (size.x * size.y < min_screen_area) {
+        return Visibility::Coarse;
+    }
+    return Visibility::Refined;
+}
+
+template <typename Write>
+Indices GridHC::collect_visible(
+        Camera::Ptr camera, float min_screen_area, Write write) {
+    glm::mat4 view_proj =
+        camera->getProjectionMatrix() * camera->getViewMatrix();
+
+    // walk the blocks top down, collecting coarse representatives and the
+    // cells that need a cut
+    PROFILE_ZONE("gridhc cut");
     Indices indices;
-    indices.reserve(splats.size());
-    uint32_t offset{0};
-    for (const auto &cell : cells) {
-        if (cell->empty()) {
+    std::vector<uint32_t> refined;
+    std::vector<uint32_t> stack;
+    if (!blocks.empty()) {
+        stack.push_back(blocks.size() - 1);
+    }
+    while (!stack.empty()) {
+        const auto &block = blocks[stack.back()];
+        stack.pop_back();
+        switch (visibility(block.bb, view_proj, min_screen_area)) {
+        case Visibility::Culled:
+            continue;
+        case Visibility::Coarse:
+            if (block.cell == HC::Node::NONE) {
+                indices.push_back(block.splat);
+            } else {
+                for (auto root : cells[block.cell]->hc.roots) {
+                    indices.push_back(offsets[block.cell] + root);
+                }
+            }
             continue;
+        case Visibility::Refined:
+            break;
         }
-        auto cell_indices = cell->hc.get_indices(camera, threshold, w);
-        for (uint32_t i = 0; i < cell_indices.size(); i++) {
-            indices.push_back(cell_indices[i] + offset); 
+        if (block.cell == HC::Node::NONE) {
+            stack.insert(stack.end(),
+                block.children.begin(), block.children.end());
+        } else {
+            refined.push_back(block.cell);
         }
-        offset += cell->hc.splats.size();
-    }             
-    std::cout << "GridHC: Found " << indices.size() << " splats" << std::endl;
+    }
+    return collect(refined, write, std::move(indices));
+}
+
+Indices GridHC::get_indices_error(
+        Camera::Ptr camera, uint32_t depth, float min_screen_area) {
+    auto indices = collect_visible(camera, min_screen_area,
+        [&](uint32_t c, uint32_t *out, uint32_t offset) {
+            return cells[c]->hc.write_indices_depth(depth, out, offset);
+        });
     return indices;
-}
\ No newline at end of file
+}
+
+Indices GridHC::get_indices(Camera::Ptr camera, float threshold,
+        HC::MetricWeights w, float min_screen_area) {
+    (void)w;
+    auto indices = collect_visible(camera, min_screen_area,
+        [&](uint32_t c, uint32_t *out, uint32_t offset) {
+            return cells[c]->hc.write_indices(
+                camera, threshold, splats.data() + offsets[c], out, offset);
+        });
+    return indices;
+}
+
+MemoryUsage GridHC::memory_usage() const {
+    MemoryUsage usage;
+    usage.add("gridhc cells", cells);
+    for (const auto &cell : cells) {
+        // the HC is a member of the cell, its own containers are added
+        // separately
+        usage.add("gridhc cells", MemoryUsage::shared<Cell>());
+        usage.add(cell->hc.memory_usage());
+    }
+    usage.add("gridhc offsets", offsets);
+    usage.add("gridhc blocks", blocks);
+    for (const auto &block : blocks) {
+        usage.add("gridhc blocks", block.children);
+    }
+    usage.add("gridhc splats", splats);
+    return usage;
+}
@@ -5,35 +5,132 @@
 
 #include "Splat.h"
 #include "HC.hpp"
+#include "BB.hpp"
+#include "Camera.h"
+#include "Memory.hpp"
 
 class GridHC {
 public:
+    // The HC of a cell is built straight into GridHC::splats, its splats
+    // start at offsets[c], the first hc.leaf_count of them are the splats
+    // of the cell.
     struct Cell {
         using Ptr = std::shared_ptr<Cell>;
-        std::vector<Splat> splats;
         HC hc;
+        // bounds of the 3 sigma extents of the cell's splats
+        BB bb;
+        // the cell is an octree node spanning 2^level finest cells per
+        // axis, key is its Morton code at that level
+        uint64_t key{0};
+        uint32_t level{0};
         bool empty() const {
-            return splats.empty();
+            return hc.leaf_count == 0;
         }
     };
 
+    // Octree over the cells. Every cell is wrapped by a leaf block, a
+    // block at level l spans 2^l finest cells per axis and is represented
+    // by one splat merged from all the roots below it.
+    struct Block {
+        uint32_t level{0};
+        uint64_t key{0};
+        // the wrapped cell of a leaf, HC::Node::NONE otherwise
+        uint32_t cell{HC::Node::NONE};
+        // blocks one level down
+        std::vector<uint32_t> children;
+        BB bb;
+        // summed weight of the merged roots
+        float weight{0.0f};
+        // representative in splats
+        uint32_t splat{0};
+    };
+
 public:
-    glm::uvec3 subdivisions{20};
+    // finest resolution of the grid, up to 2^21 per axis
+    glm::uvec3 subdivisions{256};
+    // octree nodes holding more splats are split until the finest level,
+    // HC cost grows superlinearly with the cell size
+    uint32_t max_cell_splats{4096};
+    // occupied cells in Morton order and where their splats start in
+    // splats, set by build
     std::vector<Cell::Ptr> cells;
+    std::vector<uint32_t> offsets;
     std::vector<Splat> splats;
+    // leaves first, then levels in ascending order, the top block is last
+    std::vector<Block> blocks;
 
 public:
+    // takes over splats_init and releases it once the cells hold the splats
     void build(SplatVector splats_init);
-    Indices get_indices_error(uint32_t depth, float error);
-    Indices get_indices(
-        Camera::Ptr camera, float threshold, HC::MetricWeights w);
+    // Blocks and cells outside the view frustum are skipped. Blocks
+    // covering less than min_screen_area (in NDC units) are served by their
+    // representative and cells by their HC roots, the remaining cells are
+    // cut as requested.
+    Indices get_indices_error(
+        Camera::Ptr camera, uint32_t depth, float min_screen_area);
+    Indices get_indices(Camera::Ptr camera, float threshold,
+        HC::MetricWeights w, float min_screen_area = 0.0f);
+
+    // the splats of cell c, the leaves of its HC
+    const Splat *cell_begin(uint32_t c) const {
+        return splats.data() + offsets[c];
+    }
+    const Splat *cell_end(uint32_t c) const {
+        return cell_begin(c) + cells[c]->hc.leaf_count;
+    }
+
+    // the cells with their HCs, the blocks and the splats
+    MemoryUsage memory_usage() const;
 
 private:
-    uint32_t get_index(uint32_t i, uint32_t j, uint32_t k) const {
-        auto index = i * subdivisions.y * subdivisions.z + j * subdivisions.z + k;
-        if (index >= cells.size()) {
-            throw std::out_of_range("Cell index out of range");
-        }
-        return index;
+    // (Morton key at the finest level, splat)
+    using Keyed = std::vector<std::pair<uint64_t, uint32_t>>;
+
+    enum class Visibility {
+        Culled,
+        Coarse,
+        Refined
+    };
+
+    static Visibility visibility(const BB &bb,
+        const glm::mat4 &view_proj, float min_screen_area);
+
+    // split keyed[begin, end), an octree node at level, into cells of at
+    // most max_cell_splats, appending them and the start of their range
+    void partition(const Keyed &keyed, size_t begin, size_t end,
+        uint32_t level, std::vector<size_t> &runs);
+
+    // merge the cell roots level by level into blocks, returns the
+    // representatives that go after the splats of the cells
+    SplatVector build_blocks();
+
+    // indices followed by the cuts of the given cells, offset into splats.
+    // write(c, out, offset) writes the cut of cell c to out and returns its
+    // size, at most the leaf count of the cell.
+    template <typename Write>
+    Indices collect(
+        const std::vector<uint32_t> &refined, Write write, Indices indices);
+
+    // the cuts of the refined cells of the camera's view
+    template <typename Write>
+    Indices collect_visible(
+        Camera::Ptr camera, float min_screen_area, Write write);
+
+    // spread the low 21 bits of v to every third bit
+    static uint64_t spread(uint64_t v) {
+        v &= 0x1fffff;
+        v = (v | v << 32) & 0x1f00000000ffff;
+        v = (v | v << 16) & 0x1f0000ff0000ff;
+        v = (v | v << 8) & 0x100f00f00f00f00f;
+        v = (v | v << 4) & 0x10c30c30c30c30c3;
+        v = (v | v << 2) & 0x1249249249249249;
+        return v;
+    }
+
+    // Morton code, every octree node is a contiguous range of keys and
+    // key >> 3 is the key of the parent
+    static uint64_t key(glm::uvec3 position) {
+        return spread(position.x) << 2 | spread(position.y) << 1
+            | spread(position.z);
     }
 };
\ No newline at end of file
@@ -1,168 +1,371 @@
 #include "HC.hpp"
-#include <list>
+#include <algorithm>
 
-void HC::build(SplatVector splats_init, bool verbose) {
-    std::priority_queue<Node::Ptr, std::vector<Node::Ptr>, HCComparator> queue;
-    splats.reserve(2 * splats_init.size());
+#ifdef PARALLEL
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#endif
 
-    if (verbose) {
-        std::cout << "HC: Building tree with " << splats_init.size() << " splats." << std::endl;
+HC::Adjacency HC::knn_graph() const {
+    uint32_t n = leaf_count;
+    std::vector<glm::vec3> positions(n);
+    for (uint32_t i = 0; i < n; i++) {
+        positions[i] = glm::vec3(node_splats[i].transform[3]);
+    }
+    KDTree tree;
+    tree.build(positions);
+
+    // symmetric edges (i, j) with i < j
+    std::vector<std::pair<uint32_t, uint32_t>> edges;
+    edges.reserve(n * params.neighbours);
+    for (uint32_t i = 0; i < n; i++) {
+        // the splat itself is its own nearest neighbour
+        auto neighbours = tree.knn(positions[i], params.neighbours + 1);
+        for (const auto &neighbour : neighbours) {
+            uint32_t j = neighbour.second;
+            if (j != i) {
+                edges.emplace_back(std::min(i, j), std::max(i, j));
+            }
+        }
     }
-    for (const auto &splat : splats_init) {
-        auto node = std::make_shared<Node>();
-        node->depth = 0;
-        node->index = splats.size();
-        node->splat = splat;
-        node->error = 0.0f;
-        node->nodes_it = nodes.insert(nodes.end(), node);
-        splats.push_back(splat);
+    std::sort(edges.begin(), edges.end());
+    edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+    Adjacency adjacency(2 * n);
+    for (const auto &edge : edges) {
+        adjacency[edge.first].push_back(edge.second);
+        adjacency[edge.second].push_back(edge.first);
     }
+    return adjacency;
+}
 
-    if (verbose) {
-        std::cout << "HC: Building queue with " << nodes.size() << " nodes." << std::endl;
-    }
-
-    for (auto it = nodes.begin(); it != nodes.end(); ++it) {
-        auto a = *it;
-        for (auto jt = std::next(it); jt != nodes.end(); ++jt) {
-            auto b = *jt;
-            //std::cout << "HC: Merging nodes " << a->index << " and " << b->index << std::endl;
-            auto node = merge_nodes(a, b);
-            //std::cout << "HC: Merged nodes " << a->index << " and " << b->index
-            //          << " into node " << node->index << " with error " << node->error << std::endl;
-            queue.push(node);
+void HC::connect(Adjacency &adjacency, uint32_t merged) const {
+    uint32_t a = nodes[merged].children[0];
+    uint32_t b = nodes[merged].children[1];
+
+    // the merged node inherits the neighbours of its children
+    auto &neighbours = adjacency[merged];
+    neighbours = adjacency[a];
+    neighbours.insert(neighbours.end(), adjacency[b].begin(), adjacency[b].end());
+    std::sort(neighbours.begin(), neighbours.end());
+    neighbours.erase(std::unique(neighbours.begin(), neighbours.end()),
+        neighbours.end());
+    neighbours.erase(std::remove_if(neighbours.begin(), neighbours.end(),
+        [&](uint32_t c) { return c == a || c == b; }), neighbours.end());
+
+    // large clusters only keep their nearest neighbours, otherwise a
+    // growing cluster drags its whole boundary into every merge
+    uint32_t max_degree = 4 * params.neighbours;
+    uint32_t kept = neighbours.size();
+    if (kept > max_degree) {
+        auto center = glm::vec3(node_splats[merged].transform[3]);
+        auto distance = [&](uint32_t c) {
+            auto diff = glm::vec3(node_splats[c].transform[3]) - center;
+            return glm::dot(diff, diff);
+        };
+        std::nth_element(neighbours.begin(), neighbours.begin() + max_degree,
+            neighbours.end(), [&](uint32_t c, uint32_t d) {
+                return distance(c) < distance(d);
+            });
+        kept = max_degree;
+    }
+
+    // and replaces them in the lists of its neighbours
+    for (uint32_t i = 0; i < neighbours.size(); i++) {
+        auto &list = adjacency[neighbours[i]];
+        list.erase(std::remove_if(list.begin(), list.end(),
+            [&](uint32_t d) { return d == a || d == b; }), list.end());
+        // a pruned neighbour keeps the edge if it would become isolated
+        if (i < kept) {
+            list.push_back(merged);
+        } else if (list.empty()) {
+            list.push_back(merged);
+            std::swap(neighbours[kept], neighbours[i]);
+            kept++;
         }
     }
+    neighbours.resize(kept);
+
+    adjacency[a] = {};
+    adjacency[b] = {};
+}
+
+void HC::build(SplatVector splats_init, bool verbose) {
+    leaf_count = splats_init.size();
+    splats = std::move(splats_init);
+    splats.resize(node_capacity(leaf_count));
+    node_splats = splats.data();
+    build_tree(verbose);
+    splats.resize(nodes.size());
+}
+
+void HC::build(Splat *storage, uint32_t count, bool verbose) {
+    leaf_count = count;
+    SplatVector().swap(splats);
+    node_splats = storage;
+    build_tree(verbose);
+}
+
+void HC::build_tree(bool verbose) {
+    // every splat starts with about `neighbours` candidates, reserve them
+    // up front instead of growing the heap while seeding
+    std::vector<Candidate> candidates;
+    candidates.reserve(leaf_count * std::max(params.neighbours, 1u));
+    CandidateQueue queue(CandidateComparator(), std::move(candidates));
+    nodes.clear();
+    roots.clear();
+    nodes.reserve(node_capacity(leaf_count));
 
     if (verbose) {
-        std::cout << "HC: Merging " << nodes.size() << " nodes." << std::endl;
+        std::cout << "HC: Building tree with " << leaf_count << " splats." << std::endl;
+    }
+    for (uint32_t i = 0; i < leaf_count; i++) {
+        roots.push_back(nodes.size());
+        nodes.emplace_back().weight = node_splats[i].weight();
     }
 
-    while (!queue.empty()) {
-        auto merged = queue.top();
-        queue.pop();
-        if (merged->children[0]->processed || merged->children[1]->processed) {
-            continue;
+    bool exhaustive = params.neighbours == 0;
+    Adjacency adjacency;
+    if (exhaustive) {
+        if (verbose) {
+            std::cout << "HC: Building queue with " << roots.size() << " nodes." << std::endl;
         }
-
-        merged->index = splats.size();
-        splats.push_back(merged->splat);
-
-        //std::cout << "HC: Merging nodes: "
-        //          << merged->children[0]->index << " and "
-        //          << merged->children[1]->index
-        //          << " into node " << merged->index
-        //          << " with error " << merged->error << std::endl;
-
-        // remove merged nodes from list
-        auto a = merged->children[0];
-        auto b = merged->children[1];
-        a->processed = true;
-        b->processed = true;
-        //std::cout << "HC: Unprocessed nodes >: " << nodes.size() << std::endl;
-        if (std::distance(a->nodes_it, b->nodes_it) == 0) {
-            // they're the same; erase only once
-            throw std::runtime_error("Same node, this should not happen in HC.");
-        } else {
-            // erase in order to keep iterators valid
-            if (std::distance(a->nodes_it, b->nodes_it) > 0) {
-                nodes.erase(b->nodes_it);
-                nodes.erase(a->nodes_it);
-            } else {
-                nodes.erase(a->nodes_it);
-                nodes.erase(b->nodes_it);
+        std::vector<uint32_t> others;
+        for (size_t i = 0; i < roots.size(); i++) {
+            others.assign(roots.begin() + i + 1, roots.end());
+            evaluate(roots[i], others, queue);
+        }
+    } else {
+        if (verbose) {
+            std::cout << "HC: Building queue from the " << params.neighbours
+                      << " nearest neighbours of " << roots.size() << " nodes." << std::endl;
+        }
+        adjacency = knn_graph();
+        std::vector<uint32_t> others;
+        for (auto a : roots) {
+            others.clear();
+            for (auto b : adjacency[a]) {
+                if (a < b) {
+                    others.push_back(b);
+                }
             }
+            evaluate(a, others, queue);
         }
-        //std::cout << "HC: Unprocessed nodes :<" << nodes.size() << std::endl;
+    }
+
+    if (verbose) {
+        std::cout << "HC: Merging " << roots.size() << " nodes." << std::endl;
+    }
 
-        // merge the merged node with all other nodes
-        for (auto it = nodes.begin(); it != nodes.end(); ++it) {
-            auto c = *it;
-            auto node = merge_nodes(merged, c);
-            if (node->error > params.max_error) {
+    // position of each root in roots, for constant time removal
+    std::vector<uint32_t> slots(2 * leaf_count);
+    for (uint32_t i = 0; i < roots.size(); i++) {
+        slots[roots[i]] = i;
+    }
+    auto remove_root = [&](uint32_t id) {
+        uint32_t slot = slots[id];
+        roots[slot] = roots.back();
+        slots[roots[slot]] = slot;
+        roots.pop_back();
+    };
+
+    auto merge_queue = [&]() {
+        while (!queue.empty()) {
+            auto candidate = queue.top();
+            queue.pop();
+            if (!nodes[candidate.a].is_root() || !nodes[candidate.b].is_root()) {
                 continue;
             }
-            queue.push(node);
+            if (candidate.a == candidate.b) {
+                throw std::runtime_error("Same node, this should not happen in HC.");
+            }
+
+            uint32_t merged = commit(candidate);
+
+            // remove merged nodes from the roots
+            remove_root(candidate.a);
+            remove_root(candidate.b);
+
+            // merge the merged node with all other roots, or only with the
+            // neighbours of its children
+            if (!exhaustive) {
+                connect(adjacency, merged);
+            }
+            evaluate(merged, exhaustive ? roots : adjacency[merged], queue);
+
+            // insert merged node into the roots
+            slots[merged] = roots.size();
+            roots.push_back(merged);
+        }
+    };
+    merge_queue();
+
+    // the neighbour graph may have left disconnected components
+    if (!exhaustive && roots.size() > 1 &&
+            roots.size() <= params.max_exhaustive_roots) {
+        if (verbose) {
+            std::cout << "HC: Merging " << roots.size()
+                      << " disconnected roots." << std::endl;
         }
-        
-        // insert merged node into list
-        merged->nodes_it = nodes.insert(nodes.end(), merged);
+        exhaustive = true;
+        std::vector<uint32_t> others;
+        for (size_t i = 0; i < roots.size(); i++) {
+            others.assign(roots.begin() + i + 1, roots.end());
+            evaluate(roots[i], others, queue);
+        }
+        merge_queue();
     }
 
+    // keep the roots in creation order
+    std::sort(roots.begin(), roots.end());
+
     if (verbose) {
-        std::cout << "HC: Found " << nodes.size() << " root nodes." << std::endl;
-        std::cout << "HC: First root depth: " << nodes.front()->depth << std::endl;
-        std::cout << "HC: Built tree with " << splats.size() << " splats." << std::endl;
+        std::cout << "HC: Found " << roots.size() << " root nodes." << std::endl;
+        std::cout << "HC: First root depth: " << nodes[roots.front()].depth << std::endl;
+        std::cout << "HC: Built tree with " << nodes.size() << " splats." << std::endl;
     }
-            
+    node_splats = nullptr;
+
 }
 
-Indices HC::get_indices(Camera::Ptr camera, float threshold, MetricWeights w) {
-    Indices indices;
-    std::vector<Node::Ptr> queue;
-    uint32_t pos{0};
+template <typename Keep, typename Emit>
+void HC::refine(Keep keep, size_t max_steps, Emit emit) const {
+    // Refining a FIFO queue of nodes visits them level by level. Every
+    // level is classified at once, in parallel, and then split in order
+    // into kept nodes and the children of expanded ones, which yields the
+    // same cut in the same order in linear time.
+    std::vector<uint32_t> level(roots.begin(), roots.end());
+    std::vector<uint32_t> next;
+    std::vector<uint8_t> expand;
+
+    while (!level.empty() && max_steps > 0) {
+        size_t visited = std::min(level.size(), max_steps);
+        max_steps -= visited;
+
+        expand.resize(visited);
+        auto classify = [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                const auto &node = nodes[level[i]];
+                expand[i] = !node.is_leaf() && !keep(level[i]);
+            }
+        };
+#ifdef PARALLEL
+        if (visited >= REFINE_GRAIN) {
+            tbb::parallel_for(
+                tbb::blocked_range<size_t>(0, visited, REFINE_GRAIN),
+                [&](const tbb::blocked_range<size_t> &range) {
+                    classify(range.begin(), range.end());
+                });
+        } else {
+            classify(0, visited);
+        }
+#else
+        classify(0, visited);
+#endif
 
-    for (auto &node : nodes) {
-        queue.push_back(node);
+        // kept nodes go out in runs between the expanded ones
+        next.clear();
+        size_t kept{0};
+        for (size_t i = 0; i < visited; i++) {
+            if (expand[i]) {
+                if (kept < i) {
+                    emit(level.data() + kept, level.data() + i);
+                }
+                kept = i + 1;
+                const auto &node = nodes[level[i]];
+                next.push_back(node.children[0]);
+                next.push_back(node.children[1]);
+            }
+        }
+        // out of steps, the unvisited rest of the level stays ahead of the
+        // children in the queue
+        if (kept < level.size()) {
+            emit(level.data() + kept, level.data() + level.size());
+        }
+        level.swap(next);
+    }
+    if (!level.empty()) {
+        emit(level.data(), level.data() + level.size());
     }
+}
 
+auto HC::error_keep(Camera::Ptr camera, float threshold,
+        const Splat *shared) const {
     auto camera_pos = glm::vec3(camera->worldMatrix[3]);
-    while (!queue.empty() && pos < queue.size()) {
-        auto node = queue[pos];
-        auto splat_pos = glm::vec3(node->splat.transform[3]);
+    const Splat *node_splats = shared ? shared : splats.data();
+    return [this, camera_pos, threshold, node_splats](uint32_t id) {
+        const auto &node = nodes[id];
+        const auto &splat = node_splats[id];
+        auto splat_pos = glm::vec3(splat.transform[3]);
         auto splat_dist = glm::length(splat_pos - camera_pos);
-        auto weight = node->splat.weight();
-        auto error = node->error;
+        auto weight = node.weight;
+        auto error = node.error;
         auto dist = 1 / (splat_dist * splat_dist);
         //float metric = glm::pow(error, w.e) *
         //    glm::pow(weight, w.w) * glm::pow(dist, w.d);
         float metric = error * weight * dist;
-        if (metric < threshold || node->is_leaf()) {
-            pos++;
-            continue;
-        }
-        queue.erase(queue.begin() + pos);
-        queue.push_back(node->children[0]);
-        queue.push_back(node->children[1]);
+        return metric < threshold;
+    };
+}
+
+namespace {
+
+// emit of HC::refine appending to a vector or writing with an offset
+struct Append {
+    Indices &indices;
+    void operator()(const uint32_t *first, const uint32_t *last) const {
+        indices.insert(indices.end(), first, last);
     }
-    for (auto &node : queue) {
-        indices.push_back(node->index);
+};
+
+struct Write {
+    uint32_t *&out;
+    uint32_t offset;
+    void operator()(const uint32_t *first, const uint32_t *last) const {
+        for (; first != last; ++first) {
+            *out++ = *first + offset;
+        }
     }
+};
+
+} // namespace
+
+Indices HC::get_indices(Camera::Ptr camera, float threshold,
+        MetricWeights w, const Splat *shared) {
+    Indices indices;
+    refine(error_keep(camera, threshold, shared),
+        std::numeric_limits<size_t>::max(), Append{indices});
     return indices;
 }
 
 Indices HC::get_indices_depth(uint32_t depth) {
-    std::vector<uint32_t> indices;
-    std::vector<Node::Ptr> queue;
-    uint32_t counter{0};
-    uint32_t pos{0};
-    //std::cout << "HC: Getting indices at depth " << depth << std::endl;
-    for (auto &node : nodes) {
-        queue.push_back(node);
-    }
-    while (!queue.empty() && pos < queue.size()) {
-        if (counter >= depth) {
-            break;
-        }
-        counter++;
-        auto node = queue[pos];
-        if (node->is_leaf()) {
-            pos++;
-            continue;
-        }
-        queue.erase(queue.begin() + pos);
-        queue.push_back(node->children[0]);
-        queue.push_back(node->children[1]);
-        //if (node->depth == depth) {
-        //    indices.push_back(node->index);
-        //} else if (node->depth > depth) {
-        //    queue.push_back(node->children[0]);
-        //    queue.push_back(node->children[1]);
-        //}
-    }
-    for (auto &node : queue) {
-        indices.push_back(node->index);
-    }
-    //std::cout << "HC: Found " << indices.size() << " splats at depth " << depth << std::endl;
+    // `depth` bounds the number of refinement steps, leaves included
+    Indices indices;
+    refine([](uint32_t) { return false; }, depth, Append{indices});
     return indices;
-}
\ No newline at end of file
+}
+
+size_t HC::write_indices(Camera::Ptr camera, float threshold,
+        const Splat *shared, uint32_t *out, uint32_t offset) const {
+    uint32_t *first = out;
+    refine(error_keep(camera, threshold, shared),
+        std::numeric_limits<size_t>::max(), Write{out, offset});
+    return out - first;
+}
+
+size_t HC::write_indices_depth(
+        uint32_t depth, uint32_t *out, uint32_t offset) const {
+    uint32_t *first = out;
+    refine([](uint32_t) { return false; }, depth, Write{out, offset});
+    return out - first;
+}
+
+MemoryUsage HC::memory_usage() const {
+    MemoryUsage usage;
+    usage.add("hc nodes", nodes);
+    usage.add("hc roots", roots);
+    usage.add("hc splats", splats);
+    usage.add("hc scratch", batch.capacity_bytes());
+    usage.add("hc scratch", errors);
+    return usage;
+}
@@ -4,11 +4,13 @@
 
 #include "BB.hpp"
 #include "Splat.h"
+#include "KDTree.hpp"
+#include "SplatBatch.hpp"
+#include "Memory.hpp"
 #include <vector>
 #include <array>
-#include <list>
 #include <queue>
-#include <memory>
+#include <limits>
 
 #include <iostream>
 #include <chrono>
@@ -17,6 +19,12 @@ class HC {
 public:
     struct Params {
         float max_error{std::numeric_limits<float>::infinity()};
+        // merges are only considered between spatial neighbours, starting
+        // from the k nearest neighbours of every splat; 0 tries all pairs
+        uint32_t neighbours{16};
+        // roots left unconnected by the neighbour graph are merged
+        // exhaustively if there are at most this many
+        uint32_t max_exhaustive_roots{2048};
     };
 
     struct MetricWeights {
@@ -25,71 +33,167 @@ public:
         float d{0.0f};
     };
 
+    // Nodes live in a flat arena, nodes[i] describes splats[i]. Leaves come
+    // first, merged nodes are appended in the order they are committed.
     class Node {
     public:
-        using Ptr = std::shared_ptr<Node>;
-        uint32_t depth;
-        Splat splat;
-        uint32_t index;
-        std::array<Ptr, 2> children;
+        static constexpr uint32_t NONE = std::numeric_limits<uint32_t>::max();
+        uint32_t depth{0};
+        std::array<uint32_t, 2> children{NONE, NONE};
+        uint32_t parent{NONE};
         float error{0.0f};
+        // Splat::weight of the node's splat, computed once when the node
+        // is created instead of per candidate and per frame
+        float weight{0.0f};
         bool is_leaf() const {
-            return children[0] == nullptr && children[1] == nullptr;
+            return children[0] == NONE && children[1] == NONE;
+        }
+        bool is_root() const {
+            return parent == NONE;
         }
-        std::list<Ptr>::iterator nodes_it;
-        bool processed{false};
     };
 
 public:
     Params params;
-    std::list<Node::Ptr> nodes;
+    std::vector<Node> nodes;
+    std::vector<uint32_t> roots;
     SplatVector splats;
+    // nodes[0, leaf_count) are the splats passed to build
+    uint32_t leaf_count{0};
 private:
-    struct HCComparator {
-        bool operator()(const Node::Ptr &a, const Node::Ptr &b) const {
-            return a->error > b->error; 
+    // A pending merge of two root nodes. Candidates are invalidated lazily:
+    // once either node gets a parent the entry is skipped when popped.
+    struct Candidate {
+        uint32_t a;
+        uint32_t b;
+        float error;
+    };
+
+    struct CandidateComparator {
+        bool operator()(const Candidate &a, const Candidate &b) const {
+            if (a.error != b.error) {
+                return a.error > b.error;
+            }
+            if (a.a != b.a) {
+                return a.a > b.a;
+            }
+            return a.b > b.b;
         }
     };
 
+    using CandidateQueue = std::priority_queue<
+        Candidate, std::vector<Candidate>, CandidateComparator>;
+
+    using Adjacency = std::vector<std::vector<uint32_t>>;
+
+    // levels of the cut smaller than this are refined serially
+    static constexpr size_t REFINE_GRAIN{4096};
+
+    // scratch space of evaluate
+    SplatSoA batch;
+    std::vector<float> errors;
+    // the splats of the nodes while building, splats or the storage of
+    // the owner
+    Splat *node_splats{nullptr};
+
 public:
     HC() = default;
     HC(const Params &params) : params(params) {}
 
+    // takes over splats_init as the leaves, moving in a vector with room
+    // for node_capacity(size()) splats spares the reallocation for the
+    // merged ones
     void build(SplatVector splats_init, bool verbose = true);
-    Indices get_indices(
-        Camera::Ptr camera, float threshold, MetricWeights w);
+    // builds over the count leaves at storage and writes the merged splats
+    // after them, for owners like GridHC that keep the splats of many HCs
+    // in one buffer. storage needs room for node_capacity(count) splats,
+    // splats stays empty and the owner passes storage to the cuts.
+    void build(Splat *storage, uint32_t count, bool verbose = true);
+    // the most nodes a tree over leaves can have
+    static size_t node_capacity(size_t leaves) {
+        return leaves == 0 ? 0 : 2 * leaves - 1;
+    }
+    // shared holds the splats of the nodes if an owner like GridHC built
+    // the tree into its storage
+    Indices get_indices(Camera::Ptr camera, float threshold,
+        MetricWeights w, const Splat *shared = nullptr);
     Indices get_indices_depth(uint32_t depth);
 
+    // the same cuts written to out with offset added to every id, for
+    // owners like GridHC that place the cuts of many HCs in one buffer.
+    // No cut is larger than leaf_count, out needs room for as many ids.
+    // Returns the size of the cut.
+    size_t write_indices(Camera::Ptr camera, float threshold,
+        const Splat *shared, uint32_t *out, uint32_t offset) const;
+    size_t write_indices_depth(
+        uint32_t depth, uint32_t *out, uint32_t offset) const;
+
+    // the nodes, roots, splats and the scratch space kept from the build
+    MemoryUsage memory_usage() const;
+
 private:
-    Node::Ptr merge_nodes(const Node::Ptr &a, const Node::Ptr &b) {
-        //std::cout << "Merging nodes: "
-        //          << "a: " << a->index << " b: " << b->index
-        //          << std::endl;
-        //std::cout << "Splats size: " << splats.size() << std::endl;
-        auto splat_a = splats[a->index];
-        //std::cout<< "Got splat a" << std::endl;
-        auto splat_b = splats[b->index];
-        auto w_a = splat_a.weight();
-        auto w_b = splat_b.weight();
+    // Cut through the trees below the roots, a node is replaced by its
+    // children unless it is a leaf or keep(id) holds. At most max_steps
+    // nodes are visited in breadth-first order, the rest stay in the cut.
+    // The cut is handed to emit(first, last) in order, in runs of ids.
+    template <typename Keep, typename Emit>
+    void refine(Keep keep, size_t max_steps, Emit emit) const;
+
+    // keep of the camera cut, nodes whose weighted error over the squared
+    // distance is below threshold
+    auto error_keep(Camera::Ptr camera, float threshold,
+        const Splat *shared) const;
+
+    // merges the leaf_count leaves at node_splats
+    void build_tree(bool verbose);
+    Adjacency knn_graph() const;
+    void connect(Adjacency &adjacency, uint32_t merged) const;
+
+    Splat merge_pair(uint32_t a, uint32_t b, float &w_a, float &w_b) const {
+        const auto &splat_a = node_splats[a];
+        const auto &splat_b = node_splats[b];
+        w_a = nodes[a].weight;
+        w_b = nodes[b].weight;
         auto total_weight = w_a + w_b;
         w_a /= total_weight;
         w_b /= total_weight;
+        return merge_splats(splat_a, splat_b, w_a, w_b);
+    }
+
+    // score merging a with each of others in one batch, queueing the
+    // candidates within max_error
+    void evaluate(uint32_t a, const std::vector<uint32_t> &others,
+            CandidateQueue &queue) {
+        batch.resize(others.size());
+        for (size_t i = 0; i < others.size(); i++) {
+            batch.set(i, node_splats[others[i]], nodes[others[i]].weight);
+        }
+        errors.resize(others.size());
+        merge_error_batch(node_splats[a], nodes[a].weight, batch, errors.data());
+        for (size_t i = 0; i < others.size(); i++) {
+            if (errors[i] > params.max_error) {
+                continue;
+            }
+            queue.push({a, others[i], errors[i]});
+        }
+    }
+
+    // materialize the merged splat and its node, returns the new node id
+    uint32_t commit(const Candidate &candidate) {
+        float w_a, w_b;
+        auto splat_c = merge_pair(candidate.a, candidate.b, w_a, w_b);
+        uint32_t id = nodes.size();
 
-        //std::cout << "MERGER: weights: "
-        //          << w_a << " " << w_b << std::endl;
-        auto splat_c = merge_splats(splat_a, splat_b, w_a, w_b);
-        //std::cout << "MERGER: merged splats" << std::endl;
-        auto div_a = splat_divergence(splat_a, splat_c);
-        auto div_b = splat_divergence(splat_b, splat_c);
-        auto error = (w_a * div_a + w_b * div_b);
-
-        auto node = std::make_shared<Node>();
-        node->depth = std::max(a->depth, b->depth) + 1;
-        node->splat = splat_c;
-        node->error = error;
-        node->children[0] = a;
-        node->children[1] = b;
-
-        return node;
+        Node node;
+        node.depth = std::max(
+            nodes[candidate.a].depth, nodes[candidate.b].depth) + 1;
+        node.error = candidate.error;
+        node.children = {candidate.a, candidate.b};
+        node.weight = splat_c.weight();
+        nodes[candidate.a].parent = id;
+        nodes[candidate.b].parent = id;
+        nodes.push_back(node);
+        node_splats[id] = splat_c;
+        return id;
     }
 };
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+#include "Splat.h"
+
+// Finds the ranges of the sort indices that differ from those of the last
+// frame, so that only they are uploaded to the sort index buffer. While the
+// camera rests the cut and the sort repeat themselves and nothing is
+// uploaded at all.
+class IndexDiff {
+public:
+    // changed runs fewer than this many equal indices apart are uploaded
+    // as one range, every range is a copy command of its own
+    size_t merge_gap{256};
+    // with more than this fraction of the indices changed everything is
+    // uploaded as one range
+    float full_fraction{0.5f};
+
+private:
+    // the indices the buffer holds
+    Indices previous;
+    Ranges ranges;
+    size_t changed_count{0};
+    bool valid{false};
+
+public:
+    // the ranges of indices that differ from the last call, and then
+    // remembers indices as what the buffer holds
+    const Ranges &update(const Indices &indices) {
+        ranges.clear();
+        if (!valid) {
+            push_range(ranges, {0, static_cast<uint32_t>(indices.size())});
+        } else {
+            collect(indices);
+        }
+
+        changed_count = ranges_size(ranges);
+        if (changed_count > full_fraction * indices.size()) {
+            ranges.assign(1, {0, static_cast<uint32_t>(indices.size())});
+            changed_count = indices.size();
+        }
+        previous.assign(indices.begin(), indices.end());
+        valid = true;
+        return ranges;
+    }
+
+    // the buffer lost its contents, the next update uploads everything
+    void reset() {
+        valid = false;
+    }
+
+    // indices in the ranges of the last update
+    size_t changed() const {
+        return changed_count;
+    }
+
+private:
+    void collect(const Indices &indices) {
+        // indices past the previous ones are always new, those past the
+        // current ones are not drawn
+        size_t common = std::min(previous.size(), indices.size());
+        // past this many changed indices update uploads all of them, stop
+        // comparing, e.g. while the camera moves
+        size_t full = full_fraction * indices.size();
+        size_t count{0};
+        auto current = indices.begin();
+        auto last = indices.begin() + common;
+        auto before = previous.begin();
+        while (current != last) {
+            auto first_changed = std::mismatch(current, last, before).first;
+            if (first_changed == last) {
+                break;
+            }
+            size_t begin = first_changed - indices.begin();
+            size_t end = begin + 1;
+            // extend the range until merge_gap equal indices in a row
+            for (size_t i = end; i < common && i - end < merge_gap; i++) {
+                if (indices[i] != previous[i]) {
+                    end = i + 1;
+                }
+            }
+            ranges.push_back({static_cast<uint32_t>(begin),
+                static_cast<uint32_t>(end)});
+            count += end - begin;
+            if (count > full) {
+                return;
+            }
+            current = indices.begin() + end;
+            before = previous.begin() + end;
+        }
+
+        if (indices.size() > common) {
+            Range tail{static_cast<uint32_t>(common),
+                static_cast<uint32_t>(indices.size())};
+            if (!ranges.empty() && tail.begin - ranges.back().end < merge_gap) {
+                tail.begin = ranges.back().end;
+            }
+            push_range(ranges, tail);
+        }
+    }
+};
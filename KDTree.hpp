@@ -0,0 +1,106 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <algorithm>
+#include <numeric>
+#include <utility>
+
+// Implicit kd-tree over a set of points. The points are permuted so that
+// every node is a range [begin, end) whose middle element is the splitting
+// point, the axis cycles with the depth.
+class KDTree {
+public:
+    static constexpr uint32_t LEAF_SIZE{8};
+
+    // (squared distance, point id), kept as a max-heap during queries
+    using Neighbour = std::pair<float, uint32_t>;
+
+private:
+    std::vector<glm::vec3> points;
+    std::vector<uint32_t> ids;
+
+public:
+    KDTree() = default;
+
+    void build(const std::vector<glm::vec3> &points_init) {
+        ids.resize(points_init.size());
+        std::iota(ids.begin(), ids.end(), 0);
+        build(points_init, 0, ids.size(), 0);
+
+        points.resize(ids.size());
+        for (size_t i = 0; i < ids.size(); i++) {
+            points[i] = points_init[ids[i]];
+        }
+    }
+
+    // k nearest points to `p`, sorted by distance
+    std::vector<Neighbour> knn(glm::vec3 p, uint32_t k) const {
+        std::vector<Neighbour> heap;
+        heap.reserve(k + 1);
+        if (k > 0) {
+            knn(p, k, heap, 0, points.size(), 0);
+        }
+        std::sort_heap(heap.begin(), heap.end());
+        return heap;
+    }
+
+private:
+    void build(const std::vector<glm::vec3> &points_init,
+            uint32_t begin, uint32_t end, uint32_t depth) {
+        if (end - begin <= LEAF_SIZE) {
+            return;
+        }
+        uint32_t axis = depth % 3;
+        uint32_t mid = begin + (end - begin) / 2;
+        std::nth_element(ids.begin() + begin, ids.begin() + mid,
+            ids.begin() + end, [&](uint32_t a, uint32_t b) {
+                return points_init[a][axis] < points_init[b][axis];
+            });
+        build(points_init, begin, mid, depth + 1);
+        build(points_init, mid + 1, end, depth + 1);
+    }
+
+    void visit(glm::vec3 p, uint32_t k,
+            std::vector<Neighbour> &heap, uint32_t i) const {
+        glm::vec3 diff = points[i] - p;
+        float dist = glm::dot(diff, diff);
+        if (heap.size() < k) {
+            heap.emplace_back(dist, ids[i]);
+            std::push_heap(heap.begin(), heap.end());
+        } else if (dist < heap.front().first) {
+            std::pop_heap(heap.begin(), heap.end());
+            heap.back() = {dist, ids[i]};
+            std::push_heap(heap.begin(), heap.end());
+        }
+    }
+
+    void knn(glm::vec3 p, uint32_t k, std::vector<Neighbour> &heap,
+            uint32_t begin, uint32_t end, uint32_t depth) const {
+        if (end - begin <= LEAF_SIZE) {
+            for (uint32_t i = begin; i < end; i++) {
+                visit(p, k, heap, i);
+            }
+            return;
+        }
+        uint32_t axis = depth % 3;
+        uint32_t mid = begin + (end - begin) / 2;
+        float diff = p[axis] - points[mid][axis];
+
+        // descend into the near side first, the far side only if it can
+        // still contain a closer point
+        if (diff < 0.0f) {
+            knn(p, k, heap, begin, mid, depth + 1);
+        } else {
+            knn(p, k, heap, mid + 1, end, depth + 1);
+        }
+        visit(p, k, heap, mid);
+        if (heap.size() < k || diff * diff < heap.front().first) {
+            if (diff < 0.0f) {
+                knn(p, k, heap, mid + 1, end, depth + 1);
+            } else {
+                knn(p, k, heap, begin, mid, depth + 1);
+            }
+        }
+    }
+};
@@ -0,0 +1,162 @@
+#include "Memory.hpp"
+
+#include <fstream>
+#include <iomanip>
+#include <string>
+
+#if defined(_WIN32)
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#include <psapi.h>
+#elif defined(__APPLE__)
+#include <mach/mach.h>
+#include <sys/resource.h>
+#endif
+
+size_t MemoryUsage::total() const {
+    size_t sum{0};
+    for (const auto &[name, count] : bytes) {
+        sum += count;
+    }
+    return sum;
+}
+
+void MemoryReport::begin() {
+    memory::reset_peak();
+    resident_before = memory::resident();
+}
+
+void MemoryReport::end(const MemoryUsage &usage) {
+    steady = usage;
+    resident_after = memory::resident();
+    peak_resident = memory::peak_resident();
+}
+
+void MemoryReport::print(std::ostream &out) const {
+    auto flags = out.flags();
+    auto precision = out.precision();
+    out << std::fixed << std::setprecision(1);
+    out << "Memory of the loaded scene:" << std::endl;
+    for (const auto &[name, count] : steady.bytes) {
+        out << "  " << std::left << std::setw(24) << name << std::right
+            << std::setw(10) << memory::megabytes(count) << " MB" << std::endl;
+    }
+    out << "  " << std::left << std::setw(24) << "total" << std::right
+        << std::setw(10) << memory::megabytes(steady.total()) << " MB"
+        << std::endl;
+    if (peak_resident > 0) {
+        out << "Resident " << memory::megabytes(resident_before)
+            << " MB before loading, peak " << memory::megabytes(peak_resident)
+            << " MB, " << memory::megabytes(resident_after) << " MB after"
+            << std::endl;
+    }
+    out.flags(flags);
+    out.precision(precision);
+}
+
+namespace memory {
+
+#if defined(__linux__)
+
+namespace {
+
+// a "<field>: <n> kB" line of /proc/self/status
+size_t status_field(const std::string &field) {
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line)) {
+        if (line.compare(0, field.size(), field) == 0
+                && line.size() > field.size() && line[field.size()] == ':') {
+            return std::stoull(line.substr(field.size() + 1)) * 1024;
+        }
+    }
+    return 0;
+}
+
+} // namespace
+
+size_t resident() {
+    return status_field("VmRSS");
+}
+
+size_t peak_resident() {
+    return status_field("VmHWM");
+}
+
+bool reset_peak() {
+    // see proc(5), writing 5 resets the high-water mark
+    std::ofstream clear_refs("/proc/self/clear_refs");
+    clear_refs << "5";
+    return static_cast<bool>(clear_refs.flush());
+}
+
+#elif defined(_WIN32)
+
+namespace {
+
+PROCESS_MEMORY_COUNTERS counters() {
+    PROCESS_MEMORY_COUNTERS counters{};
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters,
+            sizeof(counters))) {
+        return PROCESS_MEMORY_COUNTERS{};
+    }
+    return counters;
+}
+
+} // namespace
+
+size_t resident() {
+    return counters().WorkingSetSize;
+}
+
+size_t peak_resident() {
+    return counters().PeakWorkingSetSize;
+}
+
+bool reset_peak() {
+    // the peak working set can not be reset
+    return false;
+}
+
+#elif defined(__APPLE__)
+
+size_t resident() {
+    mach_task_basic_info info{};
+    mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+    if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO,
+            reinterpret_cast<task_info_t>(&info), &count) != KERN_SUCCESS) {
+        return 0;
+    }
+    return static_cast<size_t>(info.resident_size);
+}
+
+size_t peak_resident() {
+    rusage usage{};
+    getrusage(RUSAGE_SELF, &usage);
+    // in bytes on macOS
+    return static_cast<size_t>(usage.ru_maxrss);
+}
+
+bool reset_peak() {
+    return false;
+}
+
+#else
+
+size_t resident() {
+    return 0;
+}
+
+size_t peak_resident() {
+    return 0;
+}
+
+bool reset_peak() {
+    return false;
+}
+
+#endif
+
+} // namespace memory
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstddef>
+#include <map>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Bytes held by the containers of the LOD structures, by name.
+//
+// Vectors count their capacity, not their size, so the slack left by
+// geometric growth shows up. Objects owned through std::make_shared count
+// the control block allocated with them.
+class MemoryUsage {
+public:
+    // the use and weak counts and the vtable pointer of the block
+    // std::make_shared allocates in front of the object
+    static constexpr size_t SHARED_CONTROL_BLOCK{
+        2 * sizeof(int) + sizeof(void *)};
+
+    std::map<std::string, size_t> bytes;
+
+public:
+    void add(const std::string &name, size_t count) {
+        bytes[name] += count;
+    }
+    template <typename T>
+    void add(const std::string &name, const std::vector<T> &vector) {
+        add(name, vector.capacity() * sizeof(T));
+    }
+    void add(const MemoryUsage &other) {
+        for (const auto &[name, count] : other.bytes) {
+            add(name, count);
+        }
+    }
+
+    template <typename T>
+    static constexpr size_t shared() {
+        return sizeof(T) + SHARED_CONTROL_BLOCK;
+    }
+
+    size_t total() const;
+};
+
+// The footprint of a scene measured around its loading. The resident sizes
+// are those of the whole process as reported by the OS, zero where it does
+// not report them.
+struct MemoryReport {
+    // the structures kept for rendering once loading returned
+    MemoryUsage steady;
+    size_t resident_before{0};
+    size_t resident_after{0};
+    // high-water mark of the process while loading, the transient copies
+    // and build scratch show up as its difference to resident_after
+    size_t peak_resident{0};
+
+    // resets the high-water mark where possible and takes resident_before
+    void begin();
+    void end(const MemoryUsage &steady);
+    void print(std::ostream &out) const;
+};
+
+namespace memory {
+
+// current and peak resident set of the process in bytes
+size_t resident();
+size_t peak_resident();
+// restarts peak_resident from the current resident set, false where the OS
+// does not support it and the peak covers the whole run
+bool reset_peak();
+
+inline double megabytes(size_t bytes) {
+    return bytes / (1024.0 * 1024.0);
+}
+
+} // namespace memory
@@ -3,10 +3,13 @@
 
 
 #include "Octree.hpp"
+#include "Profiler.hpp"
 #include <numeric>
 #include <algorithm>
+#include <cmath>
+#include <limits>
 
-BB Octree::get_bb(SplatSplitVector &splats_raw) {
+BB Octree::get_bb(const SplatSplitVector &splats_raw) {
     glm::vec3 min = glm::vec3(0.0f);
     glm::vec3 max = glm::vec3(0.0f);
 
@@ -30,16 +33,27 @@ BB Octree::get_bb(SplatSplitVector &splats_raw) {
     return BB::from_aabb(min, max);
 }
 
-void Octree::build(SplatSplitVector splats_raw) {
+uint32_t Octree::partition(
+        uint32_t begin, uint32_t end, int axis, float pivot) {
+    auto first = splats_raw.begin() + begin;
+    auto last = splats_raw.begin() + end;
+    auto mid = std::partition(first, last, [&](const SplatSplit &splat) {
+        return !(splat.position[axis] > pivot);
+    });
+    return static_cast<uint32_t>(mid - splats_raw.begin());
+}
+
+void Octree::build(SplatSplitVector splats_init) {
+    PROFILE_ZONE("octree build");
     splats.clear();
+    pending.clear();
     queue.clear();
-    this->splats_raw = splats_raw;
+    splats_raw = std::move(splats_init);
     // init root node
     root = std::make_shared<Node>();
     root->depth = 0;
     root->bb = get_bb(splats_raw);
-    root->indices_raw.resize(splats_raw.size());
-    std::iota(root->indices_raw.begin(), root->indices_raw.end(), 0);
+    root->range_raw = {0, static_cast<uint32_t>(splats_raw.size())};
 
     // init queue for breath first search
     uint32_t counter{0};
@@ -50,36 +64,35 @@ void Octree::build(SplatSplitVector splats_raw) {
         counter++;
 
         if (node->depth >= max_depth ||
-                node->indices_raw.size() <= max_splats_per_node) {
+                node->range_raw.size() <= max_splats_per_node) {
             continue;
         }
 
         // split the node
         glm::vec3 center = node->bb.center();
 
-        // Create child nodes (some may be removed later)
-        std::vector<Node::Ptr> children(8);
-        for (int i = 0; i < 8; i++) {
-            children[i] = std::make_shared<Node>();
-            children[i]->depth = node->depth + 1;
+        // Reorder the node's splats in place so that each octant is
+        // contiguous, ordered by child index (x is bit 0, y 1 and z 2)
+        std::array<uint32_t, 9> bounds;
+        bounds[0] = node->range_raw.begin;
+        bounds[8] = node->range_raw.end;
+        bounds[4] = partition(bounds[0], bounds[8], 2, center.z);
+        for (int i = 0; i < 8; i += 4) {
+            bounds[i + 2] = partition(bounds[i], bounds[i + 4], 1, center.y);
         }
-
-        // Distribute indices to children
-        for (auto idx : node->indices_raw) {
-            SplatSplit &splat = splats_raw[idx];
-            int index = 0;
-            if (splat.position.x > center.x) index |= 1;
-            if (splat.position.y > center.y) index |= 2;
-            if (splat.position.z > center.z) index |= 4;
-            children[index]->indices_raw.push_back(idx);
+        for (int i = 0; i < 8; i += 2) {
+            bounds[i + 1] = partition(bounds[i], bounds[i + 2], 0, center.x);
         }
 
-        // Set bounding boxes for children
+        // Create child nodes for non-empty octants
         for (int i = 0; i < 8; i++) {
-            Node::Ptr child = children[i];
-            if (child->indices_raw.empty()) {
+            if (bounds[i] == bounds[i + 1]) {
                 continue; // Skip empty children
             }
+            Node::Ptr child = std::make_shared<Node>();
+            child->depth = node->depth + 1;
+            child->range_raw = {bounds[i], bounds[i + 1]};
+
             glm::vec3 min = node->bb.min();
             glm::vec3 max = node->bb.max();
 
@@ -127,8 +140,8 @@ void Octree::build(SplatSplitVector splats_raw) {
             Node::Ptr child = node->children[0];
             node->depth = child->depth;
             node->bb = child->bb;
-            node->indices = child->indices;
-            node->indices_raw = child->indices_raw;
+            node->range = child->range;
+            node->range_raw = child->range_raw;
             node->children = child->children;
             counter--;
             continue;
@@ -147,70 +160,156 @@ void Octree::build(SplatSplitVector splats_raw) {
 }
 
 void Octree::generate() {
-    queue[0] = root;
-    uint32_t counter{0};
-    uint32_t size{1};
-
-    splats.clear();
-    while (counter < size) {
-        Node::Ptr node = queue[counter];
-        counter++;
-
-        SplatSplitVector splats_new{node->indices_raw.size()};
-        for (uint32_t i = 0; i < node->indices_raw.size(); i++) {
-            uint32_t index = node->indices_raw[i];
-            splats_new[i] = splats_raw[index];
+    PROFILE_ZONE("octree generate");
+    compute_weights();
+
+    // the queue is in breadth first order, siblings are consecutive and
+    // so are their splats. Composing the merged splats from those of the
+    // children bottom up only costs one merge per child instead of merging
+    // the raw splats of every subtree.
+    splats.resize(queue.size());
+    for (size_t i = 0; i < queue.size(); i++) {
+        queue[i]->range = {static_cast<uint32_t>(i),
+            static_cast<uint32_t>(i + 1)};
+    }
+    for (auto it = queue.rbegin(); it != queue.rend(); ++it) {
+        Node &node = **it;
+        Splat &merged = splats[node.range.begin];
+        if (node.is_leaf()) {
+            merged = merge(splats_raw.data() + node.range_raw.begin,
+                splats_raw.data() + node.range_raw.end);
+            continue;
+        }
+        float weight{0.0f};
+        for (auto &child : node.children) {
+            const Splat &splat = splats[child->range.begin];
+            if (weight == 0.0f) {
+                merged = splat;
+            } else if (child->weight > 0.0f) {
+                float total = weight + child->weight;
+                merged = ::merge_splats(merged, splat,
+                    weight / total, child->weight / total);
+            }
+            weight += child->weight;
         }
+    }
+    compute_errors();
 
-        //if (node->is_leaf()) {
-        //    // generate splats for the node
-        //    for (auto &splat : splats_new) {
-        //        splats.push_back(split_to_splat(splat));
-        //        node->indices.push_back(splats.size() - 1);
-        //    }
-        //    continue;
-        //}
+    pending.clear();
+    for (auto &node : queue) {
+        node->drawn = !lazy;
+    }
+    materialized_nodes = lazy ? 0 : queue.size();
+}
 
-        Splat splat_merged = merge(splats_new);
-        splats.push_back(splat_merged);
-        node->indices.push_back(splats.size() - 1);
+void Octree::compute_weights() {
+    // the queue is in breadth first order, backwards every child is
+    // visited before its parent
+    for (auto it = queue.rbegin(); it != queue.rend(); ++it) {
+        Node &node = **it;
+        node.weight = 0.0f;
+        if (node.is_leaf()) {
+            for (uint32_t i = node.range_raw.begin; i < node.range_raw.end; i++) {
+                node.weight += splat_weight(splats_raw[i]);
+            }
+            continue;
+        }
+        for (auto &child : node.children) {
+            node.weight += child->weight;
+        }
+    }
+}
 
-        if (node->is_leaf()) {
+void Octree::compute_errors() {
+    for (auto it = queue.rbegin(); it != queue.rend(); ++it) {
+        Node &node = **it;
+        if (node.is_leaf()) {
+            node.error = 0.0f;
             continue;
         }
 
-        for (auto &child : node->children) {
-            queue[size] = child;
-            size++;
+        const Splat &merged = splats[node.range.begin];
+        float error{0.0f};
+        float max_child_error{0.0f};
+        for (auto &child : node.children) {
+            max_child_error = std::max(max_child_error, child->error);
+            if (child->weight == 0.0f) {
+                continue;
+            }
+            float divergence = splat_divergence(
+                splats[child->range.begin], merged);
+            // degenerate covariances can not be measured, always refine
+            if (!std::isfinite(divergence)) {
+                divergence = std::numeric_limits<float>::infinity();
+            }
+            error += child->weight / node.weight * divergence;
         }
+        node.error = std::max(error, max_child_error);
     }
 }
 
-Indices Octree::get_indices(Camera::Ptr camera, float min_screen_area) {
-    queue[0] = root;
-    uint32_t counter{0};
-    uint32_t size{1};
-    Indices indices;
-
-    while (counter < size) {
-        Node::Ptr node = queue[counter];
-        counter++;
+void Octree::materialize(Node &node) {
+    if (node.drawn) {
+        return;
+    }
+    node.drawn = true;
+    push_range(pending, node.range);
+    materialized_nodes++;
+}
 
-        float screen_area = node->bb.screen_area(camera);
-        //std::cout << "Node at depth " << node->depth
-        //          << " with " << node->indices_raw.size() << " splats, "
-        //          << "screen area: " << screen_area << std::endl;
-        if (node->is_leaf() || (screen_area < min_screen_area)) {
-            indices.insert(indices.end(),
-                node->indices.begin(), node->indices.end());
+Ranges Octree::get_ranges(Camera::Ptr camera, float threshold) {
+    Ranges ranges;
+    NodeVector stack;
+    stack.push_back(root);
+
+    glm::vec3 eye = glm::vec3(camera->worldMatrix[3]);
+    float near = camera->near;
+
+    while (!stack.empty()) {
+        Node::Ptr node = stack.back();
+        stack.pop_back();
+
+        // the divergence is relative, the node size turns it into a
+        // length that shrinks with the distance like the node on screen
+        float radius = glm::length(node->bb.size()) * 0.5f;
+        float distance = glm::length(node->bb.center() - eye) - radius;
+        float projected_error =
+            node->error * radius / std::max(distance, near);
+        if (node->is_leaf() || !(projected_error > threshold)) {
+            materialize(*node);
+            push_range(ranges, node->range);
             continue;
         }
 
-        for (auto &child : node->children) {
-            queue[size] = child;
-            size++;
+        // push in reverse so that siblings are popped in order and their
+        // consecutive ranges coalesce
+        for (auto it = node->children.rbegin();
+                it != node->children.rend(); ++it) {
+            stack.push_back(*it);
         }
     }
-    std::cout << "Found " << indices.size() << " splats." << std::endl;
-    return indices;       
+    return ranges;
+}
+
+Indices Octree::get_indices(Camera::Ptr camera, float threshold) {
+    Ranges ranges = get_ranges(camera, threshold);
+    Indices indices = ranges_to_indices(ranges);
+    PROFILE_COUNTER("octree ranges", ranges.size());
+    if (lazy) {
+        PROFILE_COUNTER("octree materialized %", materialized_fraction() * 100.0f);
+    }
+    return indices;
+}
+
+MemoryUsage Octree::memory_usage() const {
+    MemoryUsage usage;
+    // queue holds every node, the root included
+    usage.add("octree nodes", queue);
+    for (const auto &node : queue) {
+        usage.add("octree nodes", MemoryUsage::shared<Node>());
+        usage.add("octree nodes", node->children);
+    }
+    usage.add("octree splats_raw", splats_raw);
+    usage.add("octree splats", splats);
+    return usage;
 }
@@ -9,6 +9,7 @@
 #include "Splat.h"
 #include "BB.hpp"
 #include "Camera.h"
+#include "Memory.hpp"
 
 // define colors up to index 32
 const std::vector<glm::vec4> COLORS = {
@@ -61,8 +62,18 @@ public:
         using Ptr = std::shared_ptr<Node>;
         uint32_t depth;
         BB bb;
-        Indices indices;
-        Indices indices_raw;
+        // generated splats of the node, [begin, end) into splats
+        Range range;
+        // raw splats of the whole subtree, [begin, end) into splats_raw
+        Range range_raw;
+        // the splat of a lazy node entered a cut and is in pending or was
+        // taken from it
+        bool drawn{false};
+        // summed splat_weight of the raw splats
+        float weight{0.0f};
+        // weighted divergence of the children from the merged splat, at
+        // least the error of every child so that it grows towards the root
+        float error{0.0f};
         std::vector<Ptr> children;
         bool is_leaf() const {
             return children.empty();
@@ -75,13 +86,22 @@ public:
     SplatVector splats;
     uint32_t max_depth{10};
     uint32_t max_splats_per_node{1};
+    // generate merges the splat of every node into splats either way. Lazy
+    // nodes are only marked as drawn when they first enter a cut, their
+    // range is added to pending for owners that upload the splats as they
+    // are drawn instead of all at once.
+    bool lazy{false};
 
 private:
+    // permuted so that every subtree occupies one contiguous range
     SplatSplitVector splats_raw;
+    // ranges of splats of lazy nodes drawn since the last take_pending
+    Ranges pending;
     NodeVector queue;
+    uint32_t materialized_nodes{0};
 
 public:
-    void build(SplatSplitVector splats_raw);
+    void build(SplatSplitVector splats_init);
     void generate_debug() {
         // This function generates splats from raw splats and setting a color
         // for all partitions on some depth.
@@ -106,69 +126,83 @@ public:
             node_index++;
         }
         */
+        splats.clear();
+        splats.reserve(splats_raw.size());
         for (size_t node_index = 0; node_index < queue.size(); node_index++) {
             Node::Ptr node = queue[node_index];
-            //std::cout << node_index << " " << node->depth << " "
-            //          << node->indices_raw.size() << std::endl;
-            for (auto &index : node->indices_raw) {
-                //std::cout << index << " ";
-                //std::cout << splat_raw.position.x << " "
-                //          << splat_raw.position.y << " "
-                //          << splat_raw.position.z << std::endl;
-                Splat splat = split_to_splat(splats_raw[index]);
-                //std::cout << splat.transform[3].x << " "
-                //          << splat.transform[3].y << " "
-                //          << splat.transform[3].z << std::endl;
+            node->range.begin = splats.size();
+            for (uint32_t i = node->range_raw.begin; i < node->range_raw.end; i++) {
+                Splat splat = split_to_splat(splats_raw[i]);
                 splat.color = COLORS[node_index % COLORS.size()];
                 //splat.color = COLORS[node->depth % COLORS.size()];
                 splat.color.w = 1.0f;
                 splats.push_back(splat);
-                node->indices.push_back(splats.size() - 1);
             }
+            node->range.end = splats.size();
+            node->drawn = true;
         }
+        pending.clear();
+        materialized_nodes = queue.size();
     }
 
-    Indices get_indices_depth(uint32_t depth) {
-        //auto start = std::chrono::high_resolution_clock::now();
-        //Indices indices(splats.size());
-        Indices indices;
-        //auto end = std::chrono::high_resolution_clock::now();
-        //std::chrono::duration<double> elapsed = end - start;
-        //std::cout << "Time needed to initialize indices: " << elapsed.count() << "s" << std::endl;
-        //uint32_t size{0};
-        queue.clear();
-        queue.reserve(splats.size());
-        queue.push_back(root);
-        std::vector<Node::Ptr> q_tmp;
-        while (!(queue.empty())) {
-            Node::Ptr node = queue.back();
-            queue.pop_back();
+    Ranges get_ranges_depth(uint32_t depth) {
+        Ranges ranges;
+        NodeVector stack;
+        stack.push_back(root);
+        while (!(stack.empty())) {
+            Node::Ptr node = stack.back();
+            stack.pop_back();
             if (node->depth > depth || node->is_leaf()) {
-                q_tmp.push_back(node);
-                //memcpy(indices.data() + size, node->indices.data(),
-                //       node->indices.size() * sizeof(uint32_t));
-                //size += node->indices.size();
+                materialize(*node);
+                push_range(ranges, node->range);
                 continue;
             }
-            for (auto &child : node->children) {
-                queue.push_back(child);
+            // push in reverse so that siblings are popped in order and
+            // their consecutive ranges coalesce
+            for (auto it = node->children.rbegin();
+                    it != node->children.rend(); ++it) {
+                stack.push_back(*it);
             }
         }
-        for (auto &node : q_tmp) {
-            indices.insert(indices.end(), node->indices.begin(), node->indices.end());
-        }
-        //indices.resize(size);
-        return indices;    
+        return ranges;
+    }
+
+    Indices get_indices_depth(uint32_t depth) {
+        return ranges_to_indices(get_ranges_depth(depth));
     }
 
     SplatVector *data() {
         return &splats;
     }
 
+    // merges the splats of every node into splats, in queue order, and
+    // computes the node errors
     void generate();
-    Indices get_indices(Camera::Ptr camera, float min_screen_area);
+    // the ranges of splats drawn for the first time since the last call
+    Ranges take_pending() {
+        Ranges ranges;
+        ranges.swap(pending);
+        return ranges;
+    }
+    // fraction of the nodes that were drawn, all of them unless lazy
+    float materialized_fraction() const {
+        return queue.empty() ? 0.0f
+            : static_cast<float>(materialized_nodes) / queue.size();
+    }
+    // refines every node whose error, scaled by its size and projected
+    // from its distance to the camera, exceeds the threshold
+    Ranges get_ranges(Camera::Ptr camera, float threshold);
+    Indices get_indices(Camera::Ptr camera, float threshold);
+
+    // the nodes, the raw splats and the merged splats
+    MemoryUsage memory_usage() const;
 
 private:
-    BB get_bb(SplatSplitVector &splats_raw);
+    BB get_bb(const SplatSplitVector &splats_raw);
+    uint32_t partition(uint32_t begin, uint32_t end, int axis, float pivot);
     Splat merge_splats(const Indices &indices);
+    void compute_weights();
+    void compute_errors();
+    // mark a lazy node as drawn the first time it enters a cut
+    void materialize(Node &node);
 };
\ No newline at end of file
@@ -0,0 +1,213 @@
+#include "Profiler.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+
+double Profiler::Stats::mean() const {
+    if (history.empty()) {
+        return 0.0;
+    }
+    return std::accumulate(history.begin(), history.end(), 0.0)
+        / history.size();
+}
+
+double Profiler::Stats::max() const {
+    if (history.empty()) {
+        return 0.0;
+    }
+    return *std::max_element(history.begin(), history.end());
+}
+
+Profiler &Profiler::get() {
+    static Profiler profiler;
+    return profiler;
+}
+
+uint64_t Profiler::now() {
+    static const auto start = std::chrono::steady_clock::now();
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+Profiler::Ring &Profiler::ring() {
+    // rings outlive their threads, the worker pools keep their threads for
+    // the whole run anyway
+    thread_local Ring *local = [this] {
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        rings.push_back(std::make_unique<Ring>());
+        rings.back()->thread = static_cast<uint32_t>(rings.size() - 1);
+        return rings.back().get();
+    }();
+    return *local;
+}
+
+void Profiler::record(const Event &event) {
+    Ring &r = ring();
+    uint64_t head = r.head.load(std::memory_order_relaxed);
+    Event &slot = r.events[head % RING_SIZE];
+    slot = event;
+    slot.thread = r.thread;
+    r.head.store(head + 1, std::memory_order_release);
+}
+
+void Profiler::count(const char *name, double value) {
+    Event event;
+    event.name = name;
+    event.begin = event.end = now();
+    event.value = value;
+    event.counter = true;
+    record(event);
+}
+
+void Profiler::name_thread(const std::string &name) {
+    Ring &r = ring();
+    std::lock_guard<std::mutex> lock(rings_mutex);
+    r.name = name;
+}
+
+void Profiler::capture(const std::string &path, size_t frames) {
+    trace_path = path;
+    trace_frames = frames;
+    trace_events.clear();
+}
+
+void Profiler::end_frame() {
+    events.clear();
+    {
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        for (auto &r : rings) {
+            uint64_t head = r->head.load(std::memory_order_acquire);
+            uint64_t first = std::max(r->read,
+                head > RING_SIZE ? head - RING_SIZE : 0);
+            dropped_events += first - r->read;
+            size_t copied = events.size();
+            for (uint64_t i = first; i < head; i++) {
+                events.push_back(r->events[i % RING_SIZE]);
+            }
+            // the thread may have wrapped around while we copied, drop
+            // what it overwrote and the slot it may be writing
+            uint64_t wrapped = r->head.load(std::memory_order_acquire);
+            if (wrapped >= first + RING_SIZE) {
+                size_t lost = std::min<uint64_t>(
+                    wrapped + 1 - first - RING_SIZE, head - first);
+                events.erase(events.begin() + copied,
+                    events.begin() + copied + lost);
+                dropped_events += lost;
+            }
+            r->read = head;
+        }
+    }
+
+    if (trace_frames > 0) {
+        trace_events.insert(trace_events.end(), events.begin(), events.end());
+        if (--trace_frames == 0) {
+            if (write_trace()) {
+                std::cout << "Wrote " << trace_events.size()
+                          << " trace events to " << trace_path << std::endl;
+            } else {
+                std::cerr << "Could not write " << trace_path << std::endl;
+            }
+            trace_events.clear();
+        }
+    }
+
+    std::map<std::string, double> totals;
+    std::map<std::string, size_t> calls;
+    std::map<std::string, double> values;
+    for (const auto &event : events) {
+        if (event.counter) {
+            values[event.name] = event.value;
+        } else {
+            totals[event.name] += (event.end - event.begin) * 1e-6;
+            calls[event.name]++;
+        }
+    }
+
+    // zones and counters missing from this frame get a zero or keep their
+    // last value
+    for (const auto &[name, total] : totals) {
+        zone_stats[name];
+    }
+    for (auto &[name, stats] : zone_stats) {
+        auto it = totals.find(name);
+        stats.history.push_back(it == totals.end() ? 0.0 : it->second);
+        stats.calls = calls[name];
+    }
+    for (const auto &[name, value] : values) {
+        counter_stats[name];
+    }
+    for (auto &[name, stats] : counter_stats) {
+        auto it = values.find(name);
+        stats.history.push_back(it == values.end() ? stats.last() : it->second);
+    }
+    for (auto *all : {&zone_stats, &counter_stats}) {
+        for (auto &[name, stats] : *all) {
+            if (stats.history.size() > HISTORY) {
+                stats.history.erase(stats.history.begin());
+            }
+        }
+    }
+}
+
+namespace {
+
+void write_string(std::ostream &out, const std::string &value) {
+    out << '"';
+    for (char c : value) {
+        if (c == '"' || c == '\\') {
+            out << '\\';
+        }
+        out << c;
+    }
+    out << '"';
+}
+
+} // namespace
+
+bool Profiler::write_trace() const {
+    std::ofstream out(trace_path);
+    if (!out.is_open()) {
+        return false;
+    }
+    out.precision(3);
+    out << std::fixed;
+    out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+    bool first{true};
+    auto separate = [&] {
+        out << (first ? "\n" : ",\n");
+        first = false;
+    };
+
+    {
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        for (const auto &r : rings) {
+            separate();
+            out << "{\"ph\": \"M\", \"name\": \"thread_name\", \"pid\": 1, "
+                << "\"tid\": " << r->thread << ", \"args\": {\"name\": ";
+            write_string(out, r->name.empty()
+                ? "thread " + std::to_string(r->thread) : r->name);
+            out << "}}";
+        }
+    }
+
+    // timestamps and durations in microseconds
+    for (const auto &event : trace_events) {
+        separate();
+        out << "{\"name\": ";
+        write_string(out, event.name);
+        out << ", \"pid\": 1, \"tid\": " << event.thread
+            << ", \"ts\": " << event.begin * 1e-3;
+        if (event.counter) {
+            out << ", \"ph\": \"C\", \"args\": {\"value\": "
+                << event.value << "}}";
+        } else {
+            out << ", \"ph\": \"X\", \"dur\": "
+                << (event.end - event.begin) * 1e-3 << "}";
+        }
+    }
+    out << "\n]}\n";
+    return static_cast<bool>(out);
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Scoped zones and counters for the hot paths.
+//
+// Every thread records into its own ring buffer without locks, the main
+// thread drains all of them once per frame in end_frame and keeps a rolling
+// history per zone and counter for the GUI. Recording a zone costs two clock
+// reads and a store. Without PROFILER defined the macros compile to nothing.
+//
+// capture keeps the raw events of the next frames and writes them as a
+// Chrome trace, to be opened in chrome://tracing or ui.perfetto.dev. The
+// first frame also holds everything recorded before it, e.g. the loading.
+class Profiler {
+public:
+    // events a thread can record between two end_frame calls
+    static constexpr size_t RING_SIZE{1 << 14};
+    // frames of history per zone and counter
+    static constexpr size_t HISTORY{120};
+
+    struct Event {
+        // a string literal
+        const char *name{nullptr};
+        // nanoseconds since the profiler started, equal for counters
+        uint64_t begin{0};
+        uint64_t end{0};
+        double value{0.0};
+        uint32_t thread{0};
+        bool counter{false};
+    };
+
+    struct Stats {
+        // per frame total duration in ms, or counter value, oldest first
+        std::vector<double> history;
+        // zones entered in the last frame
+        size_t calls{0};
+
+        double last() const {
+            return history.empty() ? 0.0 : history.back();
+        }
+        double mean() const;
+        double max() const;
+    };
+
+private:
+    // written by its thread only, read by end_frame
+    struct Ring {
+        std::array<Event, RING_SIZE> events;
+        std::atomic<uint64_t> head{0};
+        // first event end_frame has not seen yet
+        uint64_t read{0};
+        uint32_t thread{0};
+        std::string name;
+    };
+
+    mutable std::mutex rings_mutex;
+    std::vector<std::unique_ptr<Ring>> rings;
+
+    std::map<std::string, Stats> zone_stats;
+    std::map<std::string, Stats> counter_stats;
+    std::vector<Event> events;
+    size_t dropped_events{0};
+
+    std::string trace_path;
+    size_t trace_frames{0};
+    std::vector<Event> trace_events;
+
+public:
+    static Profiler &get();
+    static uint64_t now();
+
+    // appends to the ring of the calling thread
+    void record(const Event &event);
+    void count(const char *name, double value);
+    // the name of the calling thread in traces
+    void name_thread(const std::string &name);
+
+    // collects the events of all threads since the last call and appends
+    // them to the history as one frame
+    void end_frame();
+
+    const std::map<std::string, Stats> &zones() const {
+        return zone_stats;
+    }
+    const std::map<std::string, Stats> &counters() const {
+        return counter_stats;
+    }
+    // the events collected by the last end_frame
+    const std::vector<Event> &frame_events() const {
+        return events;
+    }
+    // events overwritten before end_frame saw them
+    size_t dropped() const {
+        return dropped_events;
+    }
+
+    // records the events of the next frames end_frame collects and writes
+    // them to path after the last one
+    void capture(const std::string &path, size_t frames);
+    bool capturing() const {
+        return trace_frames > 0;
+    }
+
+private:
+    Profiler() = default;
+    Ring &ring();
+    bool write_trace() const;
+};
+
+// records the time from its construction to its destruction
+class ProfileZone {
+    const char *name;
+    uint64_t begin;
+
+public:
+    explicit ProfileZone(const char *name)
+        : name(name), begin(Profiler::now()) {}
+    ~ProfileZone() {
+        Profiler::Event event;
+        event.name = name;
+        event.begin = begin;
+        event.end = Profiler::now();
+        Profiler::get().record(event);
+    }
+    ProfileZone(const ProfileZone &) = delete;
+    ProfileZone &operator=(const ProfileZone &) = delete;
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+
+#ifdef PROFILER
+#define PROFILE_ZONE(name) \
+    ProfileZone PROFILE_CONCAT(profile_zone_, __LINE__)(name)
+#define PROFILE_COUNTER(name, value) Profiler::get().count(name, value)
+#else
+#define PROFILE_ZONE(name) ((void)0)
+#define PROFILE_COUNTER(name, value) ((void)0)
+#endif
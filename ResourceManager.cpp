@@ -1,5 +1,7 @@
 // In ResourceManager.cpp
 #include "ResourceManager.h"
+#include "SplatFile.hpp"
+#include "Profiler.hpp"
 
 using namespace wgpu;
 
@@ -34,34 +36,13 @@ ShaderModule ResourceManager::loadShaderModule(const std::filesystem::path& path
 
 
 SplatSplitVector ResourceManager::loadSplatsRaw(const std::filesystem::path& path, bool center) {
-	std::ifstream file{ path, std::ios::binary };
-	if (!file.is_open()) {
-		return {};
-	}
-
-	SplatSplitVector splats;
-	splats.clear();
-
-	SplatRaw splat;
-	while (file.read(reinterpret_cast<char*>(&splat), sizeof(SplatRaw))) {
-		splats.push_back(raw_to_split(splat));
-	}
-
-	file.close();
-
-	if (center) {
-		// center the splats
-		glm::vec3 center(0.0f);
-		for (const auto& s : splats) {
-			center += s.position;
-		}
-		center /= static_cast<float>(splats.size());
-		for (auto& s : splats) {
-			s.position -= center;
-		}
-	}
+	PROFILE_ZONE("read splats");
+	return load_splats_raw(path, center);
+}
 
-	return splats;
+SplatVector ResourceManager::loadSplatsConverted(const std::filesystem::path& path, bool center) {
+	PROFILE_ZONE("read splats");
+	return load_splats(path, center);
 }
 
 bool ResourceManager::loadSplats(
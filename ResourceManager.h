@@ -40,6 +40,15 @@ public:
 		bool center = false
 	);
 
+	/**
+	 * Load a file from `path` and return the splats as loadSplatsRaw
+	 * followed by split_to_splat would, without the raw vector in between.
+	 */
+	static SplatVector loadSplatsConverted(
+		const std::filesystem::path& path,
+		bool center = false
+	);
+
 	/**
 	 * Load a file from `path` using our ad-hoc format and populate the `splats`
 	 * vector.
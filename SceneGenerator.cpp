@@ -0,0 +1,216 @@
+#include "SceneGenerator.hpp"
+
+#include <cmath>
+#include <fstream>
+#include <future>
+#include <vector>
+#include <algorithm>
+
+#ifdef PARALLEL
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#endif
+
+namespace {
+
+// splitmix64 finalizer
+inline uint64_t mix(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+// the n-th uniform number in [0, 1) of key
+inline float uniform(uint64_t key, uint32_t n) {
+    return static_cast<float>(mix(key + n * 0xd1b54a32d192ed03ull) >> 40)
+        * (1.0f / 16777216.0f);
+}
+
+inline uint8_t byte(uint64_t key, uint32_t n) {
+    return static_cast<uint8_t>(mix(key + n * 0xd1b54a32d192ed03ull) >> 56);
+}
+
+// draws of a splat, the positions use the first ones
+enum Draw : uint32_t {
+    SCALE = 16,
+    OPACITY = SCALE + 3,
+    COLOR = OPACITY + 1,
+    ROTATION = COLOR + 3
+};
+
+// in the .splat encoding, the first component is w
+const glm::u8vec4 IDENTITY{255, 128, 128, 128};
+
+template <typename F>
+void for_blocks(uint64_t begin, uint64_t end, F f) {
+#ifdef PARALLEL
+    tbb::parallel_for(tbb::blocked_range<uint64_t>(begin, end, 16384),
+        [&](const tbb::blocked_range<uint64_t> &range) {
+            f(range.begin(), range.end());
+        });
+#else
+    f(begin, end);
+#endif
+}
+
+} // namespace
+
+glm::vec3 SceneGenerator::uniform_position(uint64_t key) const {
+    return params.extent * glm::vec3(2.0f * uniform(key, 0) - 1.0f,
+        2.0f * uniform(key, 1) - 1.0f, 2.0f * uniform(key, 2) - 1.0f);
+}
+
+glm::vec3 SceneGenerator::surface_position(uint64_t key, int &axis,
+        glm::u8vec4 &color) const {
+    float e = params.extent;
+    // a quarter of the splats cover the ground
+    uint32_t boxes = std::max(params.boxes, 1u);
+    if (uniform(key, 0) < 0.25f) {
+        axis = 1;
+        color = {90, 90, 80, 255};
+        return {e * (2.0f * uniform(key, 1) - 1.0f), -e,
+            e * (2.0f * uniform(key, 2) - 1.0f)};
+    }
+
+    uint64_t box = mix(params.seed ^ ((mix(key) % boxes + 1) << 32));
+    glm::vec3 size = e * glm::vec3(0.05f + 0.15f * uniform(box, 0),
+        0.1f + 0.9f * uniform(box, 1), 0.05f + 0.15f * uniform(box, 2));
+    glm::vec3 center(e * 0.8f * (2.0f * uniform(box, 3) - 1.0f),
+        -e + size.y, e * 0.8f * (2.0f * uniform(box, 4) - 1.0f));
+    color = {byte(box, 5), byte(box, 6), byte(box, 7), 255};
+
+    // one of the four walls or the roof
+    glm::vec3 p(2.0f * uniform(key, 3) - 1.0f, 2.0f * uniform(key, 4) - 1.0f,
+        2.0f * uniform(key, 5) - 1.0f);
+    uint32_t face = static_cast<uint32_t>(uniform(key, 6) * 5.0f);
+    switch (face) {
+    case 0: axis = 0; p.x = -1.0f; break;
+    case 1: axis = 0; p.x = 1.0f; break;
+    case 2: axis = 2; p.z = -1.0f; break;
+    case 3: axis = 2; p.z = 1.0f; break;
+    default: axis = 1; p.y = 1.0f; break;
+    }
+    return center + p * size;
+}
+
+glm::vec3 SceneGenerator::multi_scale_position(uint64_t i, uint64_t key) const {
+    // the cluster of level l is i modulo branching^(l+1), so that every
+    // cluster lies in the one of its index modulo branching^l
+    glm::vec3 position(0.0f);
+    float size = params.extent;
+    uint64_t clusters = 1;
+    for (uint32_t l = 0; l < params.levels; l++) {
+        clusters *= params.branching;
+        uint64_t cluster = mix(params.seed ^ ((i % clusters) << 8 | l));
+        position += size * glm::vec3(2.0f * uniform(cluster, 0) - 1.0f,
+            2.0f * uniform(cluster, 1) - 1.0f, 2.0f * uniform(cluster, 2) - 1.0f);
+        size *= params.ratio;
+    }
+    // spread within the smallest clusters
+    return position + size * glm::vec3(2.0f * uniform(key, 0) - 1.0f,
+        2.0f * uniform(key, 1) - 1.0f, 2.0f * uniform(key, 2) - 1.0f);
+}
+
+SplatRaw SceneGenerator::splat(uint64_t i) const {
+    uint64_t key = mix(params.seed ^ mix(i));
+    SplatRaw splat;
+
+    float log_min = std::log(params.scale_min);
+    float log_max = std::log(params.scale_max);
+    for (int a = 0; a < 3; a++) {
+        splat.scale[a] = std::exp(
+            log_min + (log_max - log_min) * uniform(key, SCALE + a));
+    }
+    float opacity = params.opacity_min
+        + (params.opacity_max - params.opacity_min) * uniform(key, OPACITY);
+    splat.color = {byte(key, COLOR), byte(key, COLOR + 1), byte(key, COLOR + 2),
+        static_cast<uint8_t>(opacity + 0.5f)};
+    splat.rotation = {byte(key, ROTATION), byte(key, ROTATION + 1),
+        byte(key, ROTATION + 2), byte(key, ROTATION + 3)};
+    // q and -q are the same rotation, a positive w also keeps q from being
+    // zero
+    splat.rotation[0] = std::max<uint8_t>(splat.rotation[0], 129);
+
+    switch (params.distribution) {
+    case Distribution::Uniform:
+        splat.position = uniform_position(key);
+        break;
+    case Distribution::Surfaces: {
+        int axis{0};
+        glm::u8vec4 color;
+        splat.position = surface_position(key, axis, color);
+        // axis aligned and flat across the surface, colored by it
+        splat.rotation = IDENTITY;
+        splat.scale[axis] = params.scale_min * 0.1f;
+        for (int c = 0; c < 3; c++) {
+            int jitter = static_cast<int>(splat.color[c]) / 8 - 16;
+            splat.color[c] = static_cast<uint8_t>(
+                std::clamp(color[c] + jitter, 0, 255));
+        }
+        break;
+    }
+    case Distribution::MultiScale:
+        splat.position = multi_scale_position(i, key);
+        break;
+    }
+    return splat;
+}
+
+void SceneGenerator::generate(uint64_t begin, uint64_t end, SplatRaw *out) const {
+    for_blocks(begin, end, [&](uint64_t first, uint64_t last) {
+        for (uint64_t i = first; i < last; i++) {
+            out[i - begin] = splat(i);
+        }
+    });
+}
+
+SplatSplitVector SceneGenerator::generate_split() const {
+    SplatSplitVector splats(params.count);
+    for_blocks(0, params.count, [&](uint64_t first, uint64_t last) {
+        for (uint64_t i = first; i < last; i++) {
+            splats[i] = raw_to_split(splat(i));
+        }
+    });
+    return splats;
+}
+
+bool SceneGenerator::write(const std::string &path) const {
+    std::ofstream file(path, std::ios::binary);
+    if (!file.is_open()) {
+        return false;
+    }
+    std::vector<SplatRaw> chunks[2];
+    std::future<void> written;
+    for (uint64_t begin = 0, c = 0; begin < params.count;
+            begin += CHUNK_SIZE, c ^= 1) {
+        uint64_t end = std::min(begin + CHUNK_SIZE, params.count);
+        chunks[c].resize(end - begin);
+        generate(begin, end, chunks[c].data());
+        if (written.valid()) {
+            written.get();
+        }
+        written = std::async(std::launch::async, [&file, &chunk = chunks[c]] {
+            file.write(reinterpret_cast<const char *>(chunk.data()),
+                chunk.size() * sizeof(SplatRaw));
+        });
+    }
+    if (written.valid()) {
+        written.get();
+    }
+    return static_cast<bool>(file);
+}
+
+bool SceneGenerator::parse_distribution(const std::string &name,
+        Distribution &distribution) {
+    if (name == "uniform") {
+        distribution = Distribution::Uniform;
+    } else if (name == "surfaces") {
+        distribution = Distribution::Surfaces;
+    } else if (name == "multiscale") {
+        distribution = Distribution::MultiScale;
+    } else {
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "Splat.h"
+
+// Procedural .splat scenes of any size for stress testing.
+//
+// Every splat is a pure function of the seed and its index, so scenes can be
+// generated in parallel, in chunks and in any order with identical results.
+//
+// Uniform: splats anywhere in the cube of half size extent.
+// Surfaces: flat splats on a ground plane and on the faces of boxes standing
+//     on it, like the walls and roofs of a city block.
+// MultiScale: splats in clusters of clusters, level l has branching^(l+1)
+//     clusters, each one ratio times the size of its parent.
+class SceneGenerator {
+public:
+    enum class Distribution {
+        Uniform,
+        Surfaces,
+        MultiScale
+    };
+
+    struct Params {
+        uint64_t count{1000000};
+        Distribution distribution{Distribution::Uniform};
+        uint64_t seed{1};
+        // half size of the cube holding the scene
+        float extent{1.0f};
+        // log uniform scale of the splat axes
+        float scale_min{0.002f};
+        float scale_max{0.02f};
+        // uniform opacity, as stored in the alpha byte
+        uint8_t opacity_min{32};
+        uint8_t opacity_max{255};
+        // boxes of Surfaces
+        uint32_t boxes{64};
+        // clusters of MultiScale
+        uint32_t levels{6};
+        uint32_t branching{8};
+        float ratio{0.3f};
+    };
+
+    // splats generated and written at once by write
+    static constexpr uint64_t CHUNK_SIZE{1 << 20};
+
+    Params params;
+
+public:
+    SceneGenerator() = default;
+    SceneGenerator(const Params &params) : params(params) {}
+
+    SplatRaw splat(uint64_t i) const;
+    // splats [begin, end) into out
+    void generate(uint64_t begin, uint64_t end, SplatRaw *out) const;
+    // all the splats, converted like loaded ones
+    SplatSplitVector generate_split() const;
+    // streams all the splats to a .splat file, generating the next chunk
+    // while the last one is written
+    bool write(const std::string &path) const;
+
+    static bool parse_distribution(const std::string &name,
+        Distribution &distribution);
+
+private:
+    glm::vec3 uniform_position(uint64_t key) const;
+    // also returns the axis the splat is flat along and its color
+    glm::vec3 surface_position(uint64_t key, int &axis,
+        glm::u8vec4 &color) const;
+    glm::vec3 multi_scale_position(uint64_t i, uint64_t key) const;
+};
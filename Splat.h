@@ -1,6 +1,8 @@
 #pragma once
 
 #include <glm/glm.hpp>
+#include <vector>
+#include <numeric>
 
 struct SplatRaw {
 	glm::vec3 position;
@@ -35,6 +37,51 @@ using SplatVector = std::vector<Splat>;
 
 using Indices = std::vector<uint32_t>;
 
+// half-open range [begin, end) of consecutive splat indices
+struct Range {
+	uint32_t begin{0};
+	uint32_t end{0};
+
+	uint32_t size() const {
+		return end - begin;
+	}
+	bool empty() const {
+		return begin == end;
+	}
+};
+
+using Ranges = std::vector<Range>;
+
+// append a range, extending the last one if the two are adjacent
+inline void push_range(Ranges &ranges, Range range) {
+	if (range.empty()) {
+		return;
+	}
+	if (!ranges.empty() && ranges.back().end == range.begin) {
+		ranges.back().end = range.end;
+		return;
+	}
+	ranges.push_back(range);
+}
+
+inline uint32_t ranges_size(const Ranges &ranges) {
+	uint32_t size{0};
+	for (const auto &range : ranges) {
+		size += range.size();
+	}
+	return size;
+}
+
+inline Indices ranges_to_indices(const Ranges &ranges) {
+	Indices indices(ranges_size(ranges));
+	auto it = indices.begin();
+	for (const auto &range : ranges) {
+		std::iota(it, it + range.size(), range.begin);
+		it += range.size();
+	}
+	return indices;
+}
+
 inline glm::mat4 quat_to_rot(glm::vec4 q) {
 	glm::mat4 rot = glm::mat3(1.0f);
 	float qr = q[0];
@@ -101,25 +148,26 @@ inline float splat_weight(const SplatSplit &splat) {
 	return alpha * volume; 
 }
 
-inline Splat merge(SplatSplitVector &splats_raw) {
+inline Splat merge(const SplatSplit *first, const SplatSplit *last) {
 	Splat splat;
 	auto covariance = glm::mat3(0.0f);
 	auto color = glm::vec4(0.0f);
+	size_t count = last - first;
 
-	std::vector<float> weights(splats_raw.size());
+	std::vector<float> weights(count);
 	float total_weight = 0.0f;
-	for (size_t i = 0; i < splats_raw.size(); i++) {
-		weights[i] = splat_weight(splats_raw[i]);
+	for (size_t i = 0; i < count; i++) {
+		weights[i] = splat_weight(first[i]);
 		total_weight += weights[i];
 	}
 
-	for (size_t i = 0; i < splats_raw.size(); i++) {
+	for (size_t i = 0; i < count; i++) {
 		weights[i] /= total_weight;
 	}
 
-	SplatVector splats(splats_raw.size());
-	for (size_t i = 0; i < splats_raw.size(); i++) {
-		splats[i] = split_to_splat(splats_raw[i]);
+	SplatVector splats(count);
+	for (size_t i = 0; i < count; i++) {
+		splats[i] = split_to_splat(first[i]);
 	}
 
 	for (size_t i = 0; i < splats.size(); i++) {
@@ -143,7 +191,12 @@ inline Splat merge(SplatSplitVector &splats_raw) {
 	return splat;
 }
 
-inline Splat merge_splats(Splat &a, Splat &b, float w_a, float w_b) {
+inline Splat merge(const SplatSplitVector &splats_raw) {
+	return merge(splats_raw.data(), splats_raw.data() + splats_raw.size());
+}
+
+inline Splat merge_splats(
+		const Splat &a, const Splat &b, float w_a, float w_b) {
 	auto a_center = glm::vec3(a.transform[3]);
 	auto b_center = glm::vec3(b.transform[3]);
 	auto center = w_a * a_center + w_b * b_center;
@@ -0,0 +1,344 @@
+#include "SplatBatch.hpp"
+
+#include <atomic>
+#include <algorithm>
+#include <cmath>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SPLAT_BATCH_X86
+#include <immintrin.h>
+#endif
+
+// the kernels of every instruction set are compiled with different target
+// options, internal linkage keeps their inline helpers from being merged
+// with the identically named ones of CpuRasterizer.cpp
+namespace {
+
+namespace scalar {
+
+using V = float;
+constexpr size_t W = 1;
+
+inline V load(const float *p) {
+    return *p;
+}
+inline void store(float *p, V a) {
+    *p = a;
+}
+inline V vlog(V a) {
+    return std::log(a);
+}
+inline V vsqrt(V a) {
+    return std::sqrt(a);
+}
+inline V vabs(V a) {
+    return std::fabs(a);
+}
+
+#include "SplatBatchKernel.inl"
+
+} // namespace scalar
+
+#ifdef SPLAT_BATCH_X86
+
+// Cephes logf polynomial, shared by the vectorized logarithms
+namespace cephes {
+constexpr float SQRTHF = 0.707106781186547524f;
+constexpr float P0 = 7.0376836292e-2f;
+constexpr float P1 = -1.1514610310e-1f;
+constexpr float P2 = 1.1676998740e-1f;
+constexpr float P3 = -1.2420140846e-1f;
+constexpr float P4 = 1.4249322787e-1f;
+constexpr float P5 = -1.6668057665e-1f;
+constexpr float P6 = 2.0000714765e-1f;
+constexpr float P7 = -2.4999993993e-1f;
+constexpr float P8 = 3.3333331174e-1f;
+constexpr float Q1 = -2.12194440e-4f;
+constexpr float Q2 = 0.693359375f;
+} // namespace cephes
+
+#if defined(__clang__)
+#pragma clang attribute push (__attribute__((target("avx2,fma"))), apply_to = function)
+#else
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+#endif
+
+namespace avx2 {
+
+struct V {
+    __m256 v;
+    V() = default;
+    V(__m256 v) : v(v) {}
+    V(float f) : v(_mm256_set1_ps(f)) {}
+};
+constexpr size_t W = 8;
+
+inline V operator+(V a, V b) {
+    return _mm256_add_ps(a.v, b.v);
+}
+inline V operator-(V a, V b) {
+    return _mm256_sub_ps(a.v, b.v);
+}
+inline V operator*(V a, V b) {
+    return _mm256_mul_ps(a.v, b.v);
+}
+inline V operator/(V a, V b) {
+    return _mm256_div_ps(a.v, b.v);
+}
+
+inline V load(const float *p) {
+    return _mm256_loadu_ps(p);
+}
+inline void store(float *p, V a) {
+    _mm256_storeu_ps(p, a.v);
+}
+inline V vsqrt(V a) {
+    return _mm256_sqrt_ps(a.v);
+}
+inline V vabs(V a) {
+    return _mm256_andnot_ps(_mm256_set1_ps(-0.0f), a.v);
+}
+
+inline V vlog(V a) {
+    using namespace cephes;
+    __m256 x = a.v;
+    __m256 invalid = _mm256_cmp_ps(x, _mm256_setzero_ps(), _CMP_LE_OQ);
+    x = _mm256_max_ps(x, _mm256_castsi256_ps(_mm256_set1_epi32(0x00800000)));
+
+    // split into exponent and mantissa in [0.5, 1)
+    __m256i bits = _mm256_castps_si256(x);
+    __m256i exponent = _mm256_sub_epi32(
+        _mm256_srli_epi32(bits, 23), _mm256_set1_epi32(0x7f));
+    bits = _mm256_and_si256(bits, _mm256_set1_epi32(~0x7f800000));
+    bits = _mm256_or_si256(bits, _mm256_castps_si256(_mm256_set1_ps(0.5f)));
+    x = _mm256_castsi256_ps(bits);
+    __m256 e = _mm256_add_ps(
+        _mm256_cvtepi32_ps(exponent), _mm256_set1_ps(1.0f));
+
+    __m256 mask = _mm256_cmp_ps(x, _mm256_set1_ps(SQRTHF), _CMP_LT_OQ);
+    __m256 tmp = _mm256_and_ps(x, mask);
+    x = _mm256_sub_ps(x, _mm256_set1_ps(1.0f));
+    e = _mm256_sub_ps(e, _mm256_and_ps(_mm256_set1_ps(1.0f), mask));
+    x = _mm256_add_ps(x, tmp);
+
+    __m256 z = _mm256_mul_ps(x, x);
+    __m256 y = _mm256_set1_ps(P0);
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(P1));
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(P2));
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(P3));
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(P4));
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(P5));
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(P6));
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(P7));
+    y = _mm256_fmadd_ps(y, x, _mm256_set1_ps(P8));
+    y = _mm256_mul_ps(_mm256_mul_ps(y, x), z);
+
+    y = _mm256_fmadd_ps(e, _mm256_set1_ps(Q1), y);
+    y = _mm256_fnmadd_ps(z, _mm256_set1_ps(0.5f), y);
+    x = _mm256_add_ps(x, y);
+    x = _mm256_fmadd_ps(e, _mm256_set1_ps(Q2), x);
+    return _mm256_or_ps(x, invalid);
+}
+
+#include "SplatBatchKernel.inl"
+
+} // namespace avx2
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#pragma clang attribute push (__attribute__((target("avx512f"))), apply_to = function)
+#else
+#pragma GCC pop_options
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+// the avx512 intrinsic headers start from undefined vectors, which trips
+// false positives in GCC's uninitialized warnings
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+namespace avx512 {
+
+struct V {
+    __m512 v;
+    V() = default;
+    V(__m512 v) : v(v) {}
+    V(float f) : v(_mm512_set1_ps(f)) {}
+};
+constexpr size_t W = 16;
+
+inline V operator+(V a, V b) {
+    return _mm512_add_ps(a.v, b.v);
+}
+inline V operator-(V a, V b) {
+    return _mm512_sub_ps(a.v, b.v);
+}
+inline V operator*(V a, V b) {
+    return _mm512_mul_ps(a.v, b.v);
+}
+inline V operator/(V a, V b) {
+    return _mm512_div_ps(a.v, b.v);
+}
+
+inline V load(const float *p) {
+    return _mm512_loadu_ps(p);
+}
+inline void store(float *p, V a) {
+    _mm512_storeu_ps(p, a.v);
+}
+inline V vsqrt(V a) {
+    return _mm512_sqrt_ps(a.v);
+}
+inline V vabs(V a) {
+    return _mm512_castsi512_ps(_mm512_and_si512(
+        _mm512_castps_si512(a.v), _mm512_set1_epi32(0x7fffffff)));
+}
+
+inline V vlog(V a) {
+    using namespace cephes;
+    __m512 x = a.v;
+    __mmask16 invalid = _mm512_cmp_ps_mask(x, _mm512_setzero_ps(), _CMP_LE_OQ);
+    x = _mm512_max_ps(x, _mm512_castsi512_ps(_mm512_set1_epi32(0x00800000)));
+
+    // split into exponent and mantissa in [0.5, 1)
+    __m512i bits = _mm512_castps_si512(x);
+    __m512i exponent = _mm512_sub_epi32(
+        _mm512_srli_epi32(bits, 23), _mm512_set1_epi32(0x7f));
+    bits = _mm512_and_si512(bits, _mm512_set1_epi32(~0x7f800000));
+    bits = _mm512_or_si512(bits, _mm512_castps_si512(_mm512_set1_ps(0.5f)));
+    x = _mm512_castsi512_ps(bits);
+    __m512 e = _mm512_add_ps(
+        _mm512_cvtepi32_ps(exponent), _mm512_set1_ps(1.0f));
+
+    __mmask16 mask = _mm512_cmp_ps_mask(x, _mm512_set1_ps(SQRTHF), _CMP_LT_OQ);
+    __m512 tmp = _mm512_maskz_mov_ps(mask, x);
+    x = _mm512_sub_ps(x, _mm512_set1_ps(1.0f));
+    e = _mm512_mask_sub_ps(e, mask, e, _mm512_set1_ps(1.0f));
+    x = _mm512_add_ps(x, tmp);
+
+    __m512 z = _mm512_mul_ps(x, x);
+    __m512 y = _mm512_set1_ps(P0);
+    y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(P1));
+    y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(P2));
+    y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(P3));
+    y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(P4));
+    y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(P5));
+    y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(P6));
+    y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(P7));
+    y = _mm512_fmadd_ps(y, x, _mm512_set1_ps(P8));
+    y = _mm512_mul_ps(_mm512_mul_ps(y, x), z);
+
+    y = _mm512_fmadd_ps(e, _mm512_set1_ps(Q1), y);
+    y = _mm512_fnmadd_ps(z, _mm512_set1_ps(0.5f), y);
+    x = _mm512_add_ps(x, y);
+    x = _mm512_fmadd_ps(e, _mm512_set1_ps(Q2), x);
+    return _mm512_mask_mov_ps(x, invalid, _mm512_set1_ps(NAN));
+}
+
+#include "SplatBatchKernel.inl"
+
+} // namespace avx512
+
+#if defined(__clang__)
+#pragma clang attribute pop
+#else
+#pragma GCC diagnostic pop
+#pragma GCC pop_options
+#endif
+
+#endif // SPLAT_BATCH_X86
+
+std::atomic<int> forced_level{-1};
+
+// run the widest available kernel on whole vectors and the scalar one on
+// the remaining lanes
+template <typename Kernel, typename... Args>
+void dispatch(Kernel scalar_kernel, [[maybe_unused]] Kernel avx2_kernel,
+        [[maybe_unused]] Kernel avx512_kernel,
+        const SplatSoA &b, float *out, const Args &...args) {
+    size_t n = b.size();
+    size_t done{0};
+    switch (simd_level()) {
+    case SimdLevel::AVX512:
+        avx512_kernel(args..., b, 0, n, out);
+        done = n - n % 16;
+        break;
+    case SimdLevel::AVX2:
+        avx2_kernel(args..., b, 0, n, out);
+        done = n - n % 8;
+        break;
+    case SimdLevel::Scalar:
+        break;
+    }
+    scalar_kernel(args..., b, done, n, out);
+}
+
+} // namespace
+
+#ifdef SPLAT_BATCH_X86
+#define SPLAT_BATCH_KERNELS(name) &scalar::name, &avx2::name, &avx512::name
+#else
+#define SPLAT_BATCH_KERNELS(name) &scalar::name, &scalar::name, &scalar::name
+#endif
+
+SimdLevel simd_level_supported() {
+#ifdef SPLAT_BATCH_X86
+    static const SimdLevel level = [] {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f")) {
+            return SimdLevel::AVX512;
+        }
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+            return SimdLevel::AVX2;
+        }
+        return SimdLevel::Scalar;
+    }();
+    return level;
+#else
+    return SimdLevel::Scalar;
+#endif
+}
+
+SimdLevel simd_level() {
+    int level = forced_level.load(std::memory_order_relaxed);
+    if (level < 0) {
+        return simd_level_supported();
+    }
+    return static_cast<SimdLevel>(level);
+}
+
+void set_simd_level(SimdLevel level) {
+    level = std::min(level, simd_level_supported());
+    forced_level.store(static_cast<int>(level), std::memory_order_relaxed);
+}
+
+const char *simd_level_name(SimdLevel level) {
+    switch (level) {
+    case SimdLevel::AVX512:
+        return "avx512";
+    case SimdLevel::AVX2:
+        return "avx2";
+    case SimdLevel::Scalar:
+        break;
+    }
+    return "scalar";
+}
+
+void kl_divergence_batch(const Splat &a, const SplatSoA &b, float *out) {
+    dispatch(SPLAT_BATCH_KERNELS(kl_divergence_batch), b, out, a);
+}
+
+void sym_kl_divergence_batch(const Splat &a, const SplatSoA &b, float *out) {
+    dispatch(SPLAT_BATCH_KERNELS(sym_kl_divergence_batch), b, out, a);
+}
+
+void splat_divergence_batch(const Splat &a, const SplatSoA &b, float *out) {
+    dispatch(SPLAT_BATCH_KERNELS(splat_divergence_batch), b, out, a);
+}
+
+void merge_error_batch(
+        const Splat &a, float weight_a, const SplatSoA &b, float *out) {
+    dispatch(SPLAT_BATCH_KERNELS(merge_error_batch), b, out, a, weight_a);
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <cstddef>
+
+#include "Splat.h"
+
+// Structure of arrays view of a set of splats, every field is stored
+// contiguously so that the batched kernels can load 8 or 16 lanes at once.
+class SplatSoA {
+public:
+    enum Field {
+        X, Y, Z,
+        XX, XY, XZ, YY, YZ, ZZ,
+        R, G, B, A,
+        // cached Splat::weight
+        W,
+        FIELDS
+    };
+
+private:
+    std::vector<float> data;
+    size_t count{0};
+
+public:
+    void resize(size_t size) {
+        count = size;
+        data.resize(FIELDS * count);
+    }
+
+    size_t size() const {
+        return count;
+    }
+
+    // allocated bytes, including the room left by earlier larger batches
+    size_t capacity_bytes() const {
+        return data.capacity() * sizeof(float);
+    }
+
+    void set(size_t i, const Splat &splat) {
+        set(i, splat, splat.weight());
+    }
+
+    void set(size_t i, const Splat &splat, float weight) {
+        const auto &t = splat.transform;
+        field(X)[i] = t[3][0];
+        field(Y)[i] = t[3][1];
+        field(Z)[i] = t[3][2];
+        field(XX)[i] = t[0][0];
+        field(XY)[i] = t[0][1];
+        field(XZ)[i] = t[0][2];
+        field(YY)[i] = t[1][1];
+        field(YZ)[i] = t[1][2];
+        field(ZZ)[i] = t[2][2];
+        field(R)[i] = splat.color.r;
+        field(G)[i] = splat.color.g;
+        field(B)[i] = splat.color.b;
+        field(A)[i] = splat.color.a;
+        field(W)[i] = weight;
+    }
+
+    void assign(const SplatVector &splats) {
+        resize(splats.size());
+        for (size_t i = 0; i < splats.size(); i++) {
+            set(i, splats[i]);
+        }
+    }
+
+    float *field(Field f) {
+        return data.data() + f * count;
+    }
+    const float *field(Field f) const {
+        return data.data() + f * count;
+    }
+};
+
+enum class SimdLevel {
+    Scalar,
+    AVX2,
+    AVX512
+};
+
+// widest instruction set supported by the CPU and the compiler
+SimdLevel simd_level_supported();
+// level used by the batched kernels, defaults to the supported one
+SimdLevel simd_level();
+// force a level (clamped to the supported one), e.g. for validation
+void set_simd_level(SimdLevel level);
+const char *simd_level_name(SimdLevel level);
+
+// out[i] = kl_divergence(a, b[i])
+void kl_divergence_batch(const Splat &a, const SplatSoA &b, float *out);
+// out[i] = sym_kl_divergence(a, b[i])
+void sym_kl_divergence_batch(const Splat &a, const SplatSoA &b, float *out);
+// out[i] = splat_divergence(a, b[i])
+void splat_divergence_batch(const Splat &a, const SplatSoA &b, float *out);
+// weighted divergence of a and b[i] from their merge, the HC merge error,
+// using the cached weights of both
+void merge_error_batch(
+    const Splat &a, float weight_a, const SplatSoA &b, float *out);
@@ -0,0 +1,189 @@
+// Batched Gaussian divergence kernels, included once per instruction set by
+// SplatBatch.cpp. The including namespace provides the lane type V, its
+// width W and the helpers load, store, vlog, vsqrt and vabs.
+
+struct Sym3 {
+    V xx, xy, xz, yy, yz, zz;
+};
+
+struct Gaussian {
+    V x, y, z;
+    Sym3 cov;
+    V r, g, b, a;
+};
+
+inline V det(const Sym3 &m) {
+    return m.xx * (m.yy * m.zz - m.yz * m.yz)
+        - m.xy * (m.xy * m.zz - m.yz * m.xz)
+        + m.xz * (m.xy * m.yz - m.yy * m.xz);
+}
+
+// closed-form inverse of a symmetric 3x3 matrix with determinant d
+inline Sym3 inverse(const Sym3 &m, V d) {
+    V inv_d = V(1.0f) / d;
+    Sym3 r;
+    r.xx = (m.yy * m.zz - m.yz * m.yz) * inv_d;
+    r.xy = (m.xz * m.yz - m.xy * m.zz) * inv_d;
+    r.xz = (m.xy * m.yz - m.xz * m.yy) * inv_d;
+    r.yy = (m.xx * m.zz - m.xz * m.xz) * inv_d;
+    r.yz = (m.xy * m.xz - m.xx * m.yz) * inv_d;
+    r.zz = (m.xx * m.yy - m.xy * m.xy) * inv_d;
+    return r;
+}
+
+// trace of the product of two symmetric matrices
+inline V trace_product(const Sym3 &a, const Sym3 &b) {
+    return a.xx * b.xx + a.yy * b.yy + a.zz * b.zz
+        + V(2.0f) * (a.xy * b.xy + a.xz * b.xz + a.yz * b.yz);
+}
+
+// x^T m x
+inline V quadratic(const Sym3 &m, V x, V y, V z) {
+    return m.xx * x * x + m.yy * y * y + m.zz * z * z
+        + V(2.0f) * (m.xy * x * y + m.xz * x * z + m.yz * y * z);
+}
+
+inline Gaussian broadcast(const Splat &splat) {
+    const auto &t = splat.transform;
+    Gaussian g;
+    g.x = V(t[3][0]);
+    g.y = V(t[3][1]);
+    g.z = V(t[3][2]);
+    g.cov = {V(t[0][0]), V(t[0][1]), V(t[0][2]),
+        V(t[1][1]), V(t[1][2]), V(t[2][2])};
+    g.r = V(splat.color.r);
+    g.g = V(splat.color.g);
+    g.b = V(splat.color.b);
+    g.a = V(splat.color.a);
+    return g;
+}
+
+inline Gaussian gather(const SplatSoA &soa, size_t i) {
+    Gaussian g;
+    g.x = load(soa.field(SplatSoA::X) + i);
+    g.y = load(soa.field(SplatSoA::Y) + i);
+    g.z = load(soa.field(SplatSoA::Z) + i);
+    g.cov.xx = load(soa.field(SplatSoA::XX) + i);
+    g.cov.xy = load(soa.field(SplatSoA::XY) + i);
+    g.cov.xz = load(soa.field(SplatSoA::XZ) + i);
+    g.cov.yy = load(soa.field(SplatSoA::YY) + i);
+    g.cov.yz = load(soa.field(SplatSoA::YZ) + i);
+    g.cov.zz = load(soa.field(SplatSoA::ZZ) + i);
+    g.r = load(soa.field(SplatSoA::R) + i);
+    g.g = load(soa.field(SplatSoA::G) + i);
+    g.b = load(soa.field(SplatSoA::B) + i);
+    g.a = load(soa.field(SplatSoA::A) + i);
+    return g;
+}
+
+// kl_divergence(p, q) given the determinants of both and the inverse of q
+inline V kl(const Gaussian &p, V det_p,
+        const Gaussian &q, V det_q, const Sym3 &inv_q) {
+    V dx = p.x - q.x;
+    V dy = p.y - q.y;
+    V dz = p.z - q.z;
+    V trace_term = trace_product(inv_q, p.cov);
+    V det_term = vlog(det_q / det_p);
+    return V(0.5f) * (trace_term + quadratic(inv_q, dx, dy, dz)
+        - V(3.0f) + det_term);
+}
+
+inline V sym_kl(const Gaussian &p, V det_p, const Sym3 &inv_p,
+        const Gaussian &q, V det_q, const Sym3 &inv_q) {
+    return V(0.5f) * (kl(p, det_p, q, det_q, inv_q)
+        + kl(q, det_q, p, det_p, inv_p));
+}
+
+inline V divergence(const Gaussian &p, V det_p, const Sym3 &inv_p,
+        const Gaussian &q, V det_q, const Sym3 &inv_q) {
+    V dr = p.r - q.r;
+    V dg = p.g - q.g;
+    V db = p.b - q.b;
+    V color_dist = vsqrt(dr * dr + dg * dg + db * db);
+    V alpha_dist = vabs(p.a - q.a);
+    return sym_kl(p, det_p, inv_p, q, det_q, inv_q) + color_dist + alpha_dist;
+}
+
+// the merge_splats of a and b with weights w_a, w_b
+inline Gaussian merge(const Gaussian &a, V w_a, const Gaussian &b, V w_b) {
+    Gaussian c;
+    c.x = w_a * a.x + w_b * b.x;
+    c.y = w_a * a.y + w_b * b.y;
+    c.z = w_a * a.z + w_b * b.z;
+    V ax = a.x - c.x, ay = a.y - c.y, az = a.z - c.z;
+    V bx = b.x - c.x, by = b.y - c.y, bz = b.z - c.z;
+    c.cov.xx = w_a * (a.cov.xx + ax * ax) + w_b * (b.cov.xx + bx * bx);
+    c.cov.xy = w_a * (a.cov.xy + ax * ay) + w_b * (b.cov.xy + bx * by);
+    c.cov.xz = w_a * (a.cov.xz + ax * az) + w_b * (b.cov.xz + bx * bz);
+    c.cov.yy = w_a * (a.cov.yy + ay * ay) + w_b * (b.cov.yy + by * by);
+    c.cov.yz = w_a * (a.cov.yz + ay * az) + w_b * (b.cov.yz + by * bz);
+    c.cov.zz = w_a * (a.cov.zz + az * az) + w_b * (b.cov.zz + bz * bz);
+    c.r = w_a * a.r + w_b * b.r;
+    c.g = w_a * a.g + w_b * b.g;
+    c.b = w_a * a.b + w_b * b.b;
+    c.a = w_a * a.a + w_b * b.a;
+    return c;
+}
+
+inline void kl_divergence_batch(const Splat &splat, const SplatSoA &soa,
+        size_t begin, size_t end, float *out) {
+    Gaussian a = broadcast(splat);
+    V det_a = det(a.cov);
+    for (size_t i = begin; i + W <= end; i += W) {
+        Gaussian b = gather(soa, i);
+        V det_b = det(b.cov);
+        store(out + i, kl(a, det_a, b, det_b, inverse(b.cov, det_b)));
+    }
+}
+
+inline void sym_kl_divergence_batch(const Splat &splat, const SplatSoA &soa,
+        size_t begin, size_t end, float *out) {
+    Gaussian a = broadcast(splat);
+    V det_a = det(a.cov);
+    Sym3 inv_a = inverse(a.cov, det_a);
+    for (size_t i = begin; i + W <= end; i += W) {
+        Gaussian b = gather(soa, i);
+        V det_b = det(b.cov);
+        store(out + i,
+            sym_kl(a, det_a, inv_a, b, det_b, inverse(b.cov, det_b)));
+    }
+}
+
+inline void splat_divergence_batch(const Splat &splat, const SplatSoA &soa,
+        size_t begin, size_t end, float *out) {
+    Gaussian a = broadcast(splat);
+    V det_a = det(a.cov);
+    Sym3 inv_a = inverse(a.cov, det_a);
+    for (size_t i = begin; i + W <= end; i += W) {
+        Gaussian b = gather(soa, i);
+        V det_b = det(b.cov);
+        store(out + i,
+            divergence(a, det_a, inv_a, b, det_b, inverse(b.cov, det_b)));
+    }
+}
+
+inline void merge_error_batch(const Splat &splat, float weight,
+        const SplatSoA &soa, size_t begin, size_t end, float *out) {
+    Gaussian a = broadcast(splat);
+    V det_a = det(a.cov);
+    Sym3 inv_a = inverse(a.cov, det_a);
+    V weight_a = V(weight);
+    for (size_t i = begin; i + W <= end; i += W) {
+        Gaussian b = gather(soa, i);
+        V det_b = det(b.cov);
+        Sym3 inv_b = inverse(b.cov, det_b);
+        V weight_b = load(soa.field(SplatSoA::W) + i);
+
+        V total_weight = weight_a + weight_b;
+        V w_a = weight_a / total_weight;
+        V w_b = weight_b / total_weight;
+
+        Gaussian c = merge(a, w_a, b, w_b);
+        V det_c = det(c.cov);
+        Sym3 inv_c = inverse(c.cov, det_c);
+
+        V div_a = divergence(a, det_a, inv_a, c, det_c, inv_c);
+        V div_b = divergence(b, det_b, inv_b, c, det_c, inv_c);
+        store(out + i, w_a * div_a + w_b * div_b);
+    }
+}
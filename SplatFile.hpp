@@ -0,0 +1,80 @@
+#pragma once
+
+#include <filesystem>
+#include <fstream>
+
+#include <glm/glm.hpp>
+
+#include "Splat.h"
+
+namespace splat_file {
+
+// splats in the file, 0 if it can not be sized
+inline size_t count(const std::filesystem::path &path) {
+    std::error_code error;
+    auto size = std::filesystem::file_size(path, error);
+    return error ? 0 : size / sizeof(SplatRaw);
+}
+
+// calls add for every splat of the file, false if it can not be opened
+template <typename Add>
+bool read(const std::filesystem::path &path, Add add) {
+    std::ifstream file{path, std::ios::binary};
+    if (!file.is_open()) {
+        return false;
+    }
+    SplatRaw splat;
+    while (file.read(reinterpret_cast<char *>(&splat), sizeof(SplatRaw))) {
+        add(splat);
+    }
+    return true;
+}
+
+} // namespace splat_file
+
+// reads a .splat file into split splats, moved to their mean position if
+// center is set, empty if the file can not be opened
+inline SplatSplitVector load_splats_raw(
+        const std::filesystem::path &path, bool center = false) {
+    SplatSplitVector splats;
+    splats.reserve(splat_file::count(path));
+    splat_file::read(path, [&](const SplatRaw &splat) {
+        splats.push_back(raw_to_split(splat));
+    });
+
+    if (center && !splats.empty()) {
+        glm::vec3 mean(0.0f);
+        for (const auto &s : splats) {
+            mean += s.position;
+        }
+        mean /= static_cast<float>(splats.size());
+        for (auto &s : splats) {
+            s.position -= mean;
+        }
+    }
+    return splats;
+}
+
+// load_splats_raw converted with split_to_splat, without holding the split
+// splats. Centering after the conversion moves the same positions by the
+// same mean.
+inline SplatVector load_splats(
+        const std::filesystem::path &path, bool center = false) {
+    SplatVector splats;
+    splats.reserve(splat_file::count(path));
+    splat_file::read(path, [&](const SplatRaw &splat) {
+        splats.push_back(split_to_splat(raw_to_split(splat)));
+    });
+
+    if (center && !splats.empty()) {
+        glm::vec3 mean(0.0f);
+        for (const auto &s : splats) {
+            mean += glm::vec3(s.transform[3]);
+        }
+        mean /= static_cast<float>(splats.size());
+        for (auto &s : splats) {
+            s.transform[3] -= glm::vec4(mean, 0.0f);
+        }
+    }
+    return splats;
+}
@@ -8,6 +8,7 @@
 #include "ResourceManager.h"
 #include "Camera.h"
 #include <memory>
+#include <functional>
 // include library for measuring time
 #include <chrono>
 
@@ -26,15 +27,32 @@ using namespace wgpu;
 #include <vector>
 #include "Octree.hpp"
 #include "gui.hpp"
+#include "SplatSort.hpp"
+#include "Profiler.hpp"
+#include "Memory.hpp"
+#include "IndexDiff.hpp"
+#include "StagingRing.hpp"
+#include "ViewState.hpp"
 using namespace std;
 
 class SplatMesh {
 public:
+    // the splats of meshes without a LOD structure, the others render the
+    // splats of their structure in place, see renderSplats
     SplatVector splatData;
     std::vector<uint32_t> indices;
 
     Buffer splatBuffer;
     Buffer sortIndexBuffer;
+    // splats the buffers have room for, at least renderSplats().size()
+    size_t splatCapacity{0};
+    // leading splats of renderSplats() that are in splatBuffer
+    size_t uploadedSplats{0};
+    // splatBuffer is allocated for all of renderSplats(), but the mesh
+    // uploads the ranges it draws itself with uploadSplatRanges
+    bool uploadOnDraw{false};
+    // called after uploadSplats reallocated the buffers, to bind them again
+    std::function<void(RenderPassEncoder &)> onBuffersResized;
 
     Buffer quadBuffer;
     Buffer indexQuadBuffer;
@@ -46,32 +64,64 @@ public:
     Device device;
     Queue queue;
 
+    // what changed in indices since the last upload, and the buffers the
+    // changes are copied through
+    IndexDiff indexDiff;
+    StagingRing staging;
+
+    // the camera and parameters indices were cut and sorted for
+    ViewState indicesView;
+    bool indicesValid{false};
+
+    // footprint of the structures and of the process around the last load
+    MemoryReport memoryReport;
+
     virtual void render(RenderPassEncoder &renderPass,
             Camera::Ptr camera, GUI::Parameters &params) {
-        (void)params; // to avoid unused parameter warning
         // Set the vertex buffer and index buffer for the splat mesh
         setBuffers(renderPass);
-        auto cameraPos = glm::vec3(camera->worldMatrix[3]);
-        sortSplats(indices, cameraPos);
-        queue.writeBuffer(sortIndexBuffer, 0, indices.data(),
-            indices.size() * sizeof(uint32_t));
+        if (!reuseIndices(camera, params)) {
+            auto cameraPos = glm::vec3(camera->worldMatrix[3]);
+            sortSplats(indices, cameraPos);
+            uploadIndices(indices);
+        }
         renderPass.drawIndexed(6, indices.size(), 0, 0, 0);
     }
 
     virtual void loadData(const std::string &path, bool center) {
-        SplatSplitVector splats_s = ResourceManager::loadSplatsRaw(path, center);
-        std::cout << splats_s.size() << " splats loaded from " << path << std::endl;
-        splatData.resize(splats_s.size());
-        for (size_t i = 0; i < splats_s.size(); i++) {
-            splatData[i] = split_to_splat(splats_s[i]);
-        }
+        splatData = ResourceManager::loadSplatsConverted(path, center);
+        std::cout << splatData.size() << " splats loaded from " << path << std::endl;
         indices.resize(splatData.size());
         std::iota(indices.begin(), indices.end(), 0);
     }
 
+    // loadData, reporting the memory it left behind and its peak
+    void load(const std::string &path, bool center) {
+        memoryReport.begin();
+        loadData(path, center);
+        invalidateIndices();
+        memoryReport.end(memoryUsage());
+        memoryReport.print(std::cout);
+    }
+
+    // the splats mirrored by splatBuffer, indexed by the sort indices
+    virtual const SplatVector &renderSplats() const {
+        return splatData;
+    }
+
+    // the CPU side copies kept for rendering, meshes add their LOD
+    // structure
+    virtual MemoryUsage memoryUsage() const {
+        MemoryUsage usage;
+        usage.add("splatData", splatData);
+        usage.add("indices", indices);
+        return usage;
+    }
+
     void initialize(Device &device, Queue &queue) {
         this->device = device;
         this->queue = queue;
+        staging.initialize(device);
         initializeBuffers();
         initializeVertexBufferLayouts();
     }
@@ -81,36 +131,82 @@ public:
         renderPass.setIndexBuffer(indexQuadBuffer, IndexFormat::Uint16, 0, indexQuadBuffer.getSize());
     }
 
-    void sortSplats(std::vector<uint32_t> &indices,
-            glm::vec3 cameraPos) {
-        // measure the time needed to sort the splats
-
-        auto start = std::chrono::high_resolution_clock::now();
+    // upload the splats appended to renderSplats() since the last upload,
+    // growing the buffers geometrically when they run out of room
+    void uploadSplats(RenderPassEncoder &renderPass) {
+        PROFILE_ZONE("upload splats");
+        const auto &splats = renderSplats();
+        if (splats.size() > splatCapacity) {
+            splatCapacity = std::max(splats.size(), 2 * splatCapacity);
+            splatBuffer.release();
+            sortIndexBuffer.release();
+            initializeSplatBuffer();
+            initializeSortIndexBuffer();
+            if (onBuffersResized) {
+                onBuffersResized(renderPass);
+            }
+            return;
+        }
+        queue.writeBuffer(splatBuffer, uploadedSplats * sizeof(Splat),
+            splats.data() + uploadedSplats,
+            (splats.size() - uploadedSplats) * sizeof(Splat));
+        uploadedSplats = splats.size();
+    }
 
-        std::vector<float> distances(splatData.size());
-        for (uint32_t i : indices) {
-            glm::vec3 position = glm::vec3(splatData[i].transform[3]);
-            distances[i] = glm::distance(position, cameraPos);
+    // upload ranges of renderSplats() drawn for the first time
+    void uploadSplatRanges(const Ranges &ranges) {
+        if (ranges.empty()) {
+            return;
+        }
+        PROFILE_ZONE("upload splats");
+        const auto &splats = renderSplats();
+        for (const auto &range : ranges) {
+            queue.writeBuffer(splatBuffer, range.begin * sizeof(Splat),
+                splats.data() + range.begin, range.size() * sizeof(Splat));
         }
+    }
 
+    void sortSplats(std::vector<uint32_t> &indices,
+            glm::vec3 cameraPos) {
+        PROFILE_ZONE("sort");
+        sort_back_to_front(renderSplats(), indices, cameraPos);
+    }
 
-        #ifdef PARALLEL
-        tbb::task_arena arena(8);
-        arena.execute([&] {
-            std::sort(std::execution::par, indices.begin(), indices.end(), [&](uint32_t a, uint32_t b) {
-                return distances[a] > distances[b];
-            });
-        });
-        #else
-        std::sort(indices.begin(), indices.end(), [&](uint32_t a, uint32_t b) {
-            return distances[a] > distances[b];
-        });
-        #endif
-        
+    // true if indices and the sort index buffer still hold the cut and sort
+    // for camera and params, otherwise they are taken as those the cut and
+    // sort about to run are for
+    bool reuseIndices(Camera::Ptr camera, const GUI::Parameters &params) {
+        ViewState view(*camera, params);
+        bool reuse = indicesValid && view == indicesView;
+        PROFILE_COUNTER("indices reused", reuse);
+        indicesView = view;
+        indicesValid = true;
+        return reuse;
+    }
 
-        auto end = std::chrono::high_resolution_clock::now();
-        std::chrono::duration<double> elapsed = end - start;
-        std::cout << "Time needed to sort the splats: " << elapsed.count() << "s" << std::endl;
+    // the next render cuts and sorts again, e.g. after the splats changed
+    void invalidateIndices() {
+        indicesValid = false;
+    }
+
+    // the sorted indices of this frame into the sort index buffer, only
+    // the ranges that differ from the last frame. The copies are submitted
+    // on their own, ahead of the frame that draws with them.
+    void uploadIndices(const std::vector<uint32_t> &indices) {
+        PROFILE_ZONE("upload indices");
+        PROFILE_COUNTER("splats drawn", indices.size());
+        const auto &ranges = indexDiff.update(indices);
+        PROFILE_COUNTER("indices uploaded", indexDiff.changed());
+        if (ranges.empty()) {
+            return;
+        }
+        if (staging.upload(queue, sortIndexBuffer, indices.data(), ranges)) {
+            return;
+        }
+        for (const auto &range : ranges) {
+            queue.writeBuffer(sortIndexBuffer, range.begin * sizeof(uint32_t),
+                indices.data() + range.begin, range.size() * sizeof(uint32_t));
+        }
     }
 
     ~SplatMesh() {
@@ -137,21 +233,29 @@ private:
     }
 
     void initializeSplatBuffer() {
+        const auto &splats = renderSplats();
+        splatCapacity = std::max({splatCapacity, splats.size(), size_t(1)});
         BufferDescriptor bufferDesc;
-        bufferDesc.size = splatData.size() * sizeof(Splat);
+        bufferDesc.size = splatCapacity * sizeof(Splat);
         bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Storage;
         bufferDesc.mappedAtCreation = false;
         splatBuffer = device.createBuffer(bufferDesc);
 
-        queue.writeBuffer(splatBuffer, 0, splatData.data(), bufferDesc.size);
+        if (!uploadOnDraw) {
+            queue.writeBuffer(splatBuffer, 0, splats.data(),
+                splats.size() * sizeof(Splat));
+        }
+        uploadedSplats = splats.size();
     }
 
     void initializeSortIndexBuffer() {
         BufferDescriptor bufferDesc;
-        bufferDesc.size = splatData.size() * sizeof(uint32_t);
+        bufferDesc.size = splatCapacity * sizeof(uint32_t);
         bufferDesc.usage = BufferUsage::CopyDst | BufferUsage::Storage;
         bufferDesc.mappedAtCreation = false;
         sortIndexBuffer = device.createBuffer(bufferDesc);
+        indexDiff.reset();
+        invalidateIndices();
     }
 
     void initializeIndexQuadBuffer() {        
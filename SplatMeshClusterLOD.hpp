@@ -0,0 +1,70 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+#include <vector>
+#include <algorithm>
+#include <execution>
+#include "Splat.h"
+#include "ResourceManager.h"
+#include "Camera.h"
+#include <memory>
+// include library for measuring time
+#include <chrono>
+
+
+using namespace wgpu;
+
+
+#include <iostream>
+#include <vector>
+#include "GridHC.hpp"
+#include "ClusterLOD.hpp"
+#include "gui.hpp"
+#include "SplatMesh.h"
+using namespace std;
+
+class SplatMeshClusterLOD : public SplatMesh{
+public:
+    GridHC gridhc;
+    ClusterLOD clusters;
+
+    void render(RenderPassEncoder &renderPass,
+            Camera::Ptr camera, GUI::Parameters &params) override {
+        // Set the vertex buffer and index buffer for the splat mesh
+        setBuffers(renderPass);
+        if (!reuseIndices(camera, params)) {
+            {
+                PROFILE_ZONE("cut");
+                indices = clusters.get_indices(camera, params.error_threshold * 0.01f);
+            }
+            auto cameraPos = glm::vec3(camera->worldMatrix[3]);
+            sortSplats(indices, cameraPos);
+            uploadIndices(indices);
+        }
+        renderPass.drawIndexed(6, indices.size(), 0, 0, 0);
+    }
+
+    void loadData(const std::string &path, bool center) override {
+        SplatVector splats = ResourceManager::loadSplatsConverted(path, center);
+        std::cout << splats.size() << " splats loaded from " << path << std::endl;
+        auto start = std::chrono::high_resolution_clock::now();
+        gridhc.build(std::move(splats));
+        clusters.build(gridhc);
+        // the grid only seeds the clusters, which copy the splats they draw
+        gridhc = GridHC();
+        auto end = std::chrono::high_resolution_clock::now();
+        std::chrono::duration<double> elapsed = end - start;
+        std::cout << "Time needed to build clusters: " << elapsed.count() << "s" << std::endl;
+    }
+
+    const SplatVector &renderSplats() const override {
+        return clusters.splats;
+    }
+
+    MemoryUsage memoryUsage() const override {
+        MemoryUsage usage = SplatMesh::memoryUsage();
+        usage.add(gridhc.memory_usage());
+        usage.add(clusters.memory_usage());
+        return usage;
+    }
+};
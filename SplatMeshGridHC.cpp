@@ -4,49 +4,52 @@ void SplatMeshGridHC::render(RenderPassEncoder &renderPass,
         Camera::Ptr camera, GUI::Parameters &params) {
     // Set the vertex buffer and index buffer for the splat mesh
     setBuffers(renderPass);
-    // time indices
-    auto start = std::chrono::high_resolution_clock::now();
-    indices = gridhc.get_indices_error(params.depth, params.min_screen_area);
-    //HC::MetricWeights w{
-    //    params.weight_e, params.weight_w, params.weight_d
-    //};
-    //indices = gridhc.get_indices(camera, params.min_screen_area * 0.1, w);
-    auto end = std::chrono::high_resolution_clock::now();
-    std::chrono::duration<double> elapsed = end - start;
-    std::cout << "Time needed to get indices: " << elapsed.count() << "s" << std::endl;
-    //std::cout << "Rendering " << indices.size() << " splats at depth "
-    //    << params.depth << std::endl;
-    auto cameraPos = glm::vec3(camera->worldMatrix[3]);
-    sortSplats(indices, cameraPos);
-    queue.writeBuffer(sortIndexBuffer, 0, indices.data(),
-        indices.size() * sizeof(uint32_t));
+    if (!reuseIndices(camera, params)) {
+        {
+            PROFILE_ZONE("cut");
+            indices = gridhc.get_indices_error(
+                camera, params.depth, params.coarse_cell_area * 0.01f);
+            //HC::MetricWeights w{
+            //    params.weight_e, params.weight_w, params.weight_d
+            //};
+            //indices = gridhc.get_indices(camera, params.error_threshold * 0.1, w,
+            //    params.coarse_cell_area * 0.01f);
+        }
+        //std::cout << "Rendering " << indices.size() << " splats at depth "
+        //    << params.depth << std::endl;
+        auto cameraPos = glm::vec3(camera->worldMatrix[3]);
+        sortSplats(indices, cameraPos);
+        uploadIndices(indices);
+    }
     renderPass.drawIndexed(6, indices.size(), 0, 0, 0);
 }
 
 void SplatMeshGridHC::loadData(const std::string &path, bool center) {
-    SplatSplitVector splats_s = ResourceManager::loadSplatsRaw(path, center);
-    SplatVector splats(splats_s.size());
-    for (size_t i = 0; i < splats_s.size(); i++) {
-        splats[i] = split_to_splat(splats_s[i]);
-    }
+    SplatVector splats = ResourceManager::loadSplatsConverted(path, center);
     // keep only the first 100 splats
     const uint32_t maxSplats = 1000000;
     if (splats.size() > maxSplats) {
         splats.resize(maxSplats);
     }
-    SplatVector splats_new;
-    for (auto splat : splats) {
-        if (splat.transform[3][0] > 0.0f) {
-            splats_new.push_back(splat);
-        }
-    }
-    splats = splats_new;
+    splats.erase(std::remove_if(splats.begin(), splats.end(),
+        [](const Splat &splat) {
+            return !(splat.transform[3][0] > 0.0f);
+        }), splats.end());
     std::cout << splats.size() << " splats loaded from " << path << std::endl;
     auto start = std::chrono::high_resolution_clock::now();
-    gridhc.build(splats);
+    gridhc.build(std::move(splats));
     auto end = std::chrono::high_resolution_clock::now();
     std::chrono::duration<double> elapsed = end - start;
     std::cout << "Time needed to build HC: " << elapsed.count() << "s" << std::endl;
     std::cout << "HC built with " << gridhc.splats.size() << " splats." << std::endl;
-    splatData = gridhc.splats;
-}
\ No newline at end of file
+}
+
+const SplatVector &SplatMeshGridHC::renderSplats() const {
+    return gridhc.splats;
+}
+
+MemoryUsage SplatMeshGridHC::memoryUsage() const {
+    MemoryUsage usage = SplatMesh::memoryUsage();
+    usage.add(gridhc.memory_usage());
+    return usage;
+}
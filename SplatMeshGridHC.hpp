@@ -38,4 +38,8 @@ public:
             Camera::Ptr camera, GUI::Parameters &params) override;
 
     void loadData(const std::string &path, bool center) override;
+
+    const SplatVector &renderSplats() const override;
+
+    MemoryUsage memoryUsage() const override;
 };
\ No newline at end of file
@@ -38,20 +38,19 @@ public:
             Camera::Ptr camera, GUI::Parameters &params) override {
         // Set the vertex buffer and index buffer for the splat mesh
         setBuffers(renderPass);
-        // time indices
-        auto start = std::chrono::high_resolution_clock::now();
-        indices = hc.get_indices_depth(params.depth);
-        //std::vector<uint32_t> indices =
-        //    octree.get_indices(camera, params.min_screen_area*0.01);
-        auto end = std::chrono::high_resolution_clock::now();
-        std::chrono::duration<double> elapsed = end - start;
-        std::cout << "Time needed to get indices: " << elapsed.count() << "s" << std::endl;
-        //std::cout << "Rendering " << indices.size() << " splats at depth "
-        //    << params.depth << std::endl;
-        auto cameraPos = glm::vec3(camera->worldMatrix[3]);
-        sortSplats(indices, cameraPos);
-        queue.writeBuffer(sortIndexBuffer, 0, indices.data(),
-            indices.size() * sizeof(uint32_t));
+        if (!reuseIndices(camera, params)) {
+            {
+                PROFILE_ZONE("cut");
+                indices = hc.get_indices_depth(params.depth);
+                //std::vector<uint32_t> indices =
+                //    octree.get_indices(camera, params.error_threshold*0.01);
+            }
+            //std::cout << "Rendering " << indices.size() << " splats at depth "
+            //    << params.depth << std::endl;
+            auto cameraPos = glm::vec3(camera->worldMatrix[3]);
+            sortSplats(indices, cameraPos);
+            uploadIndices(indices);
+        }
         renderPass.drawIndexed(6, indices.size(), 0, 0, 0);
     }
 
@@ -63,16 +62,7 @@ public:
         //}
         //splatCount = static_cast<uint32_t>(splatData.size());	
 
-        SplatSplitVector splats_s = ResourceManager::loadSplatsRaw(path, center);
-        SplatVector splats(splats_s.size());
-        for (size_t i = 0; i < splats_s.size(); i++) {
-            splats[i] = split_to_splat(splats_s[i]);
-        }
-        // keep only the first 100 splats
-        const uint32_t maxSplats = 500;
-        if (splats.size() > maxSplats) {
-            splats.resize(maxSplats);
-        }
+        SplatVector splats = ResourceManager::loadSplatsConverted(path, center);
         //SplatVector splats_new;
         //for (auto splat : splats) {
         //    if (splat.transform[3][0] > 1.25f) {
@@ -82,11 +72,20 @@ public:
         //splats = splats_new;
         std::cout << splats.size() << " splats loaded from " << path << std::endl;
         auto start = std::chrono::high_resolution_clock::now();
-        hc.build(splats);
+        hc.build(std::move(splats));
         auto end = std::chrono::high_resolution_clock::now();
         std::chrono::duration<double> elapsed = end - start;
         std::cout << "Time needed to build HC: " << elapsed.count() << "s" << std::endl;
         std::cout << "HC built with " << hc.splats.size() << " splats." << std::endl;
-        splatData = hc.splats;
+    }
+
+    const SplatVector &renderSplats() const override {
+        return hc.splats;
+    }
+
+    MemoryUsage memoryUsage() const override {
+        MemoryUsage usage = SplatMesh::memoryUsage();
+        usage.add(hc.memory_usage());
+        return usage;
     }
 };
\ No newline at end of file
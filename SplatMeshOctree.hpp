@@ -32,25 +32,27 @@ using namespace std;
 class SplatMeshOctree : public SplatMesh{
 public:
     Octree octree;
-    
+    // upload the splats of the nodes when they first enter a cut,
+    // otherwise all of them when loading
+    bool lazy = true;
+
+
     void render(RenderPassEncoder &renderPass,
             Camera::Ptr camera, GUI::Parameters &params) override {
         // Set the vertex buffer and index buffer for the splat mesh
         setBuffers(renderPass);
-        // time indices
-        auto start = std::chrono::high_resolution_clock::now();
-        //indices = octree.get_indices_depth(params.depth);
-        std::vector<uint32_t> indices =
-            octree.get_indices(camera, params.min_screen_area*0.01);
-        auto end = std::chrono::high_resolution_clock::now();
-        std::chrono::duration<double> elapsed = end - start;
-        std::cout << "Time needed to get indices: " << elapsed.count() << "s" << std::endl;
-        std::cout << "Rendering " << indices.size() << " splats at depth "
-            << params.depth << std::endl;
-        auto cameraPos = glm::vec3(camera->worldMatrix[3]);
-        sortSplats(indices, cameraPos);
-        queue.writeBuffer(sortIndexBuffer, 0, indices.data(),
-            indices.size() * sizeof(uint32_t));
+        if (!reuseIndices(camera, params)) {
+            {
+                PROFILE_ZONE("cut");
+                //indices = octree.get_indices_depth(params.depth);
+                indices = octree.get_indices(camera, params.error_threshold*0.01);
+            }
+            // splats drawn for the first time in this cut
+            uploadSplatRanges(octree.take_pending());
+            auto cameraPos = glm::vec3(camera->worldMatrix[3]);
+            sortSplats(indices, cameraPos);
+            uploadIndices(indices);
+        }
         renderPass.drawIndexed(6, indices.size(), 0, 0, 0);
     }
 
@@ -69,12 +71,22 @@ public:
         //    splatsRaw.resize(maxSplats);
         //}
         std::cout << splats_s.size() << " splats loaded from " << path << std::endl;
-        octree.build(splats_s);
+        octree.build(std::move(splats_s));
+        octree.lazy = lazy;
+        uploadOnDraw = lazy;
         //octree.generate_debug();
         octree.generate();
         std::cout << "Octree built with " << octree.splats.size() << " splats." << std::endl;
-        splatData = octree.splats;
-        std::cout << "Splat Transform: " << splatData[0].transform << std::endl;
 
     }
+
+    const SplatVector &renderSplats() const override {
+        return octree.splats;
+    }
+
+    MemoryUsage memoryUsage() const override {
+        MemoryUsage usage = SplatMesh::memoryUsage();
+        usage.add(octree.memory_usage());
+        return usage;
+    }
 };
\ No newline at end of file
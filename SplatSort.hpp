@@ -0,0 +1,38 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#ifdef PARALLEL
+#include <execution>
+#include <tbb/task_arena.h>
+#endif
+
+#include "Splat.h"
+
+// orders indices back to front by the distance of their splats to
+// camera_pos, the order the sort index buffer is drawn in
+inline void sort_back_to_front(const SplatVector &splats, Indices &indices,
+        glm::vec3 camera_pos) {
+    std::vector<float> distances(splats.size());
+    for (uint32_t i : indices) {
+        glm::vec3 position = glm::vec3(splats[i].transform[3]);
+        distances[i] = glm::distance(position, camera_pos);
+    }
+
+#ifdef PARALLEL
+    tbb::task_arena arena(8);
+    arena.execute([&] {
+        std::sort(std::execution::par, indices.begin(), indices.end(),
+            [&](uint32_t a, uint32_t b) {
+                return distances[a] > distances[b];
+            });
+    });
+#else
+    std::sort(indices.begin(), indices.end(), [&](uint32_t a, uint32_t b) {
+        return distances[a] > distances[b];
+    });
+#endif
+}
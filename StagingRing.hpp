@@ -0,0 +1,149 @@
+#pragma once
+
+#include <webgpu/webgpu.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+
+#include "Splat.h"
+#include "Profiler.hpp"
+
+// A ring of mappable buffers for uploading ranges of an array to a GPU
+// buffer. The ranges are packed into a buffer while it is mapped, copied to
+// the destination in a submit of their own and the buffer is mapped again
+// afterwards. The map completing is the fence: only then the GPU is done
+// reading it and it goes back into the ring. The callbacks run in
+// device.tick() or device.poll(), which the main loop calls once per frame.
+class StagingRing {
+public:
+    static constexpr size_t SIZE{3};
+
+private:
+    struct Slot {
+        wgpu::Buffer buffer{nullptr};
+        size_t capacity{0};
+        // writable by the CPU, false while a copy from it may be pending
+        bool mapped{false};
+        // the map failed, e.g. the device was lost, recreate the buffer
+        bool failed{false};
+        std::unique_ptr<wgpu::BufferMapCallback> pending;
+    };
+
+    wgpu::Device device{nullptr};
+    std::array<Slot, SIZE> slots;
+    size_t next{0};
+
+public:
+    StagingRing() = default;
+    StagingRing(const StagingRing &) = delete;
+    StagingRing &operator=(const StagingRing &) = delete;
+
+    ~StagingRing() {
+        release();
+    }
+
+    void initialize(wgpu::Device device) {
+        release();
+        this->device = device;
+    }
+
+    void release() {
+        for (auto &slot : slots) {
+            // destroying the buffer aborts a pending map before its
+            // callback goes away
+            if (slot.buffer) {
+                slot.buffer.destroy();
+                slot.buffer.release();
+            }
+            slot = Slot();
+        }
+        next = 0;
+    }
+
+    // copies the ranges of data to destination, false if every buffer is
+    // still in flight and the caller has to upload another way
+    bool upload(wgpu::Queue &queue, wgpu::Buffer &destination,
+            const uint32_t *data, const Ranges &ranges) {
+        size_t bytes = ranges_size(ranges) * sizeof(uint32_t);
+        Slot *slot = acquire(bytes);
+        if (!slot) {
+            return false;
+        }
+
+        auto *packed = static_cast<uint8_t *>(
+            slot->buffer.getMappedRange(0, slot->capacity));
+        size_t offset{0};
+        for (const auto &range : ranges) {
+            std::memcpy(packed + offset, data + range.begin,
+                range.size() * sizeof(uint32_t));
+            offset += range.size() * sizeof(uint32_t);
+        }
+        slot->buffer.unmap();
+        slot->mapped = false;
+
+        wgpu::CommandEncoderDescriptor encoderDesc = {};
+        encoderDesc.label = "Staging upload";
+        wgpu::CommandEncoder encoder = device.createCommandEncoder(encoderDesc);
+        offset = 0;
+        for (const auto &range : ranges) {
+            encoder.copyBufferToBuffer(slot->buffer, offset, destination,
+                range.begin * sizeof(uint32_t), range.size() * sizeof(uint32_t));
+            offset += range.size() * sizeof(uint32_t);
+        }
+        wgpu::CommandBufferDescriptor commandDesc = {};
+        commandDesc.label = "Staging upload";
+        wgpu::CommandBuffer command = encoder.finish(commandDesc);
+        encoder.release();
+        queue.submit(1, &command);
+        command.release();
+
+        // mapped again once the copies have executed
+        slot->pending = slot->buffer.mapAsync(wgpu::MapMode::Write, 0,
+            slot->capacity, [slot](wgpu::BufferMapAsyncStatus status) {
+                slot->mapped = status == wgpu::BufferMapAsyncStatus::Success;
+                slot->failed = !slot->mapped;
+            });
+        return true;
+    }
+
+private:
+    // the next mapped buffer in the ring, grown to hold bytes
+    Slot *acquire(size_t bytes) {
+        for (size_t i = 0; i < SIZE; i++) {
+            Slot &slot = slots[(next + i) % SIZE];
+            bool empty = !slot.buffer || slot.failed;
+            if (!empty && !slot.mapped) {
+                continue;
+            }
+            if (empty || slot.capacity < bytes) {
+                create(slot, bytes);
+            }
+            next = (next + i + 1) % SIZE;
+            return &slot;
+        }
+        PROFILE_COUNTER("staging ring full", 1);
+        return nullptr;
+    }
+
+    void create(Slot &slot, size_t bytes) {
+        slot.pending.reset();
+        if (slot.buffer) {
+            slot.buffer.destroy();
+            slot.buffer.release();
+        }
+        // grow geometrically like the splat buffer, in whole words
+        slot.capacity = std::max({bytes, 2 * slot.capacity, size_t(4)});
+        slot.capacity = (slot.capacity + 3) / 4 * 4;
+        wgpu::BufferDescriptor bufferDesc;
+        bufferDesc.label = "Staging";
+        bufferDesc.size = slot.capacity;
+        bufferDesc.usage = wgpu::BufferUsage::MapWrite | wgpu::BufferUsage::CopySrc;
+        bufferDesc.mappedAtCreation = true;
+        slot.buffer = device.createBuffer(bufferDesc);
+        slot.mapped = true;
+        slot.failed = false;
+    }
+};
@@ -0,0 +1,30 @@
+#pragma once
+
+#include <glm/glm.hpp>
+
+#include "Camera.h"
+#include "gui.hpp"
+
+// What the cut and the sort of a frame depend on. Frames with equal states
+// draw the same splats in the same order, the later ones reuse the indices
+// of the first. The splat size, cut off and dithering only change uniforms
+// and the camera rates and debug settings nothing drawn at all.
+struct ViewState {
+    glm::mat4 world{0.0f};
+    glm::mat4 projection{0.0f};
+    GUI::Parameters params;
+
+    ViewState() = default;
+    ViewState(Camera &camera, const GUI::Parameters &params)
+        : world(camera.worldMatrix),
+          projection(camera.getProjectionMatrix()),
+          params(params) {}
+
+    bool operator==(const ViewState &other) const {
+        return world == other.world && projection == other.projection
+            && params.cut_tie() == other.params.cut_tie();
+    }
+    bool operator!=(const ViewState &other) const {
+        return !(*this == other);
+    }
+};
@@ -0,0 +1,147 @@
+// Renders a .splat scene headless with CpuRasterizer and writes it as a PPM,
+// optionally comparing it against a golden image.
+//
+//   CpuRender <scene.splat> <out.ppm> [--golden <ppm>] [--width <px>]
+//       [--height <px>] [--distance <d>] [--yaw <deg>] [--pitch <deg>]
+//       [--fov <deg>] [--splat-size <s>] [--cut-off <c>]
+//       [--bayer-size <n>] [--bayer-scale <s>] [--scalar]
+//
+// The camera orbits the centered scene like the app's OrbitCamera. Exits
+// with 1 if the image differs from the golden one in any pixel.
+
+#include <iostream>
+#include <string>
+#include <cstdlib>
+#include <chrono>
+#include <algorithm>
+#include <numeric>
+
+#include "CpuRasterizer.hpp"
+#include "SplatBatch.hpp"
+#include "OrbitCamera.h"
+#include "SplatFile.hpp"
+
+namespace {
+
+// SplatMesh::sortSplats, stable so that ties do not change the image
+Indices sort_splats(const SplatVector &splats, glm::vec3 camera_pos) {
+    Indices indices(splats.size());
+    std::iota(indices.begin(), indices.end(), 0);
+    std::vector<float> distances(splats.size());
+    for (uint32_t i : indices) {
+        distances[i] = glm::distance(
+            glm::vec3(splats[i].transform[3]), camera_pos);
+    }
+    std::stable_sort(indices.begin(), indices.end(), [&](uint32_t a, uint32_t b) {
+        return distances[a] > distances[b];
+    });
+    return indices;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0]
+                  << " <scene.splat> <out.ppm> [--golden <ppm>] [options]"
+                  << std::endl;
+        return 1;
+    }
+    std::string scene_path = argv[1];
+    std::string out_path = argv[2];
+    std::string golden_path;
+
+    CpuRasterizer rasterizer;
+    CpuRasterizer::Uniforms uniforms;
+    float distance{5.0f};
+    float yaw{0.0f};
+    float pitch{0.0f};
+    float fov{45.0f};
+    for (int i = 3; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--scalar") {
+            set_simd_level(SimdLevel::Scalar);
+            continue;
+        }
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << arg << std::endl;
+            return 1;
+        }
+        std::string value = argv[++i];
+        if (arg == "--golden") {
+            golden_path = value;
+        } else if (arg == "--width") {
+            rasterizer.params.width = std::stoul(value);
+        } else if (arg == "--height") {
+            rasterizer.params.height = std::stoul(value);
+        } else if (arg == "--distance") {
+            distance = std::stof(value);
+        } else if (arg == "--yaw") {
+            yaw = std::stof(value);
+        } else if (arg == "--pitch") {
+            pitch = std::stof(value);
+        } else if (arg == "--fov") {
+            fov = std::stof(value);
+        } else if (arg == "--splat-size") {
+            uniforms.splatSize = std::stof(value);
+        } else if (arg == "--cut-off") {
+            uniforms.cutOff = std::stof(value);
+        } else if (arg == "--bayer-size") {
+            uniforms.bayerSize = std::stoul(value);
+        } else if (arg == "--bayer-scale") {
+            uniforms.bayerScale = std::stof(value);
+        } else {
+            std::cerr << "Unknown option " << arg << std::endl;
+            return 1;
+        }
+    }
+
+    SplatVector splats = load_splats(scene_path, true);
+    if (splats.empty()) {
+        std::cerr << "Could not load splats from " << scene_path << std::endl;
+        return 1;
+    }
+    std::cout << splats.size() << " splats loaded from " << scene_path << std::endl;
+
+    auto orbit = std::make_shared<OrbitCamera>(distance);
+    orbit->rotate(glm::vec3(0.0f, 1.0f, 0.0f), glm::radians(yaw));
+    orbit->rotate(orbit->rotation[0], glm::radians(pitch));
+    Camera::Ptr camera = orbit->camera;
+    camera->fov = fov;
+    camera->aspect = static_cast<float>(rasterizer.params.width)
+        / rasterizer.params.height;
+    orbit->updateWorldMatrix(glm::mat4(1.0f));
+
+    uniforms.projectionMatrix = camera->getProjectionMatrix();
+    uniforms.viewMatrix = camera->getViewMatrix();
+    Indices sorted = sort_splats(splats, glm::vec3(camera->worldMatrix[3]));
+
+    auto start = std::chrono::high_resolution_clock::now();
+    CpuRasterizer::Image image = rasterizer.render(splats, sorted, uniforms);
+    auto end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> elapsed = end - start;
+    const auto &stats = rasterizer.stats;
+    std::cout << "Rendered " << image.width << "x" << image.height << " with "
+              << simd_level_name(simd_level()) << " in " << elapsed.count()
+              << "s: " << stats.projected << " splats projected, "
+              << stats.shaded << " of " << stats.binned
+              << " tile fragments shaded, " << stats.saturated_tiles
+              << " tiles saturated." << std::endl;
+
+    if (!image.write_ppm(out_path)) {
+        std::cerr << "Could not write " << out_path << std::endl;
+        return 1;
+    }
+    if (golden_path.empty()) {
+        return 0;
+    }
+
+    CpuRasterizer::Image golden;
+    if (!golden.read_ppm(golden_path)) {
+        std::cerr << "Could not read golden image " << golden_path << std::endl;
+        return 1;
+    }
+    size_t differences = image.count_differences(golden);
+    std::cout << differences << " pixels differ from " << golden_path << std::endl;
+    return differences == 0 ? 0 : 1;
+}
@@ -5,6 +5,12 @@
 #include <backends/imgui_impl_glfw.h>
 #include <GLFW/glfw3.h>
 
+#include <map>
+#include <string>
+#include <utility>
+
+#include "Profiler.hpp"
+
 void GUI::init(GLFWwindow *window, Renderer *renderer) {
     this->window = window;
     this->renderer = renderer;
@@ -104,11 +110,15 @@ void GUI::update(RenderPassEncoder renderPass) {
 		ImGui::TableNextRow();
 
 		add_int_slider("Depth", reinterpret_cast<int*>(&params.depth), 0, 2000);
-		add_float_slider("Min Screen Area", &params.min_screen_area, 0.0f, 1.0f);
+		add_float_slider("Error Threshold", &params.error_threshold, 0.0f, 1.0f);
+		add_float_slider("Coarse Cell Area", &params.coarse_cell_area, 0.0f, 1.0f);
+		add_int_slider("Trace frames", reinterpret_cast<int*>(&params.traceFrames), 1, 600);
 
 		ImGui::EndTable();
 	}
 
+	ImGui::Checkbox("Record camera path", &params.recordPath);
+
 
 	if (ImGui::BeginTable("table5", 2, ImGuiTableFlags_SizingStretchProp | ImGuiTableFlags_BordersOuter)) {
 		ImGui::TableSetupColumn("Text", ImGuiTableColumnFlags_WidthFixed, columnWidth); // Auto stretch
@@ -130,6 +140,9 @@ void GUI::update(RenderPassEncoder renderPass) {
 	ImGui::Text("%.3f ms/frame (%.1f FPS)",
         1000.0f / imGuiIo.Framerate, imGuiIo.Framerate);
 
+	add_profiler();
+	add_memory();
+
 	ImGui::End();
 
     // Draw the UI
@@ -140,6 +153,145 @@ void GUI::update(RenderPassEncoder renderPass) {
     ImGui_ImplWGPU_RenderDrawData(ImGui::GetDrawData(), renderPass);
 }
 
+void GUI::add_profiler() {
+	const auto &profiler = Profiler::get();
+	if (profiler.zones().empty() && profiler.counters().empty()) {
+		return;
+	}
+
+	ImGui::Separator();
+	ImGui::Text("PROFILER (last %zu frames)", Profiler::HISTORY);
+
+	if (ImGui::BeginTable("zones", 5,
+        ImGuiTableFlags_SizingFixedFit | ImGuiTableFlags_BordersOuter))
+        {
+		ImGui::TableSetupColumn("Zone");
+		ImGui::TableSetupColumn("Last ms");
+		ImGui::TableSetupColumn("Mean ms");
+		ImGui::TableSetupColumn("Max ms");
+		ImGui::TableSetupColumn("Calls");
+		ImGui::TableHeadersRow();
+
+		for (const auto &[name, stats] : profiler.zones()) {
+			ImGui::TableNextRow();
+			ImGui::TableSetColumnIndex(0);
+			ImGui::Text("%s", name.c_str());
+			ImGui::TableSetColumnIndex(1);
+			ImGui::Text("%.3f", stats.last());
+			ImGui::TableSetColumnIndex(2);
+			ImGui::Text("%.3f", stats.mean());
+			ImGui::TableSetColumnIndex(3);
+			ImGui::Text("%.3f", stats.max());
+			ImGui::TableSetColumnIndex(4);
+			ImGui::Text("%zu", stats.calls);
+		}
+
+		ImGui::EndTable();
+	}
+
+	if (ImGui::BeginTable("counters", 3,
+        ImGuiTableFlags_SizingFixedFit | ImGuiTableFlags_BordersOuter))
+        {
+		ImGui::TableSetupColumn("Counter");
+		ImGui::TableSetupColumn("Last");
+		ImGui::TableSetupColumn("Mean");
+		ImGui::TableHeadersRow();
+
+		for (const auto &[name, stats] : profiler.counters()) {
+			ImGui::TableNextRow();
+			ImGui::TableSetColumnIndex(0);
+			ImGui::Text("%s", name.c_str());
+			ImGui::TableSetColumnIndex(1);
+			ImGui::Text("%.0f", stats.last());
+			ImGui::TableSetColumnIndex(2);
+			ImGui::Text("%.1f", stats.mean());
+		}
+
+		ImGui::EndTable();
+	}
+
+	if (profiler.dropped() > 0) {
+		ImGui::Text("%zu events dropped", profiler.dropped());
+	}
+	if (profiler.capturing()) {
+		ImGui::Text("Capturing a trace...");
+	} else {
+		ImGui::Text("F12 captures a trace");
+	}
+}
+
+void GUI::add_memory() {
+	if (!memoryUsage && !memoryReport) {
+		return;
+	}
+
+	ImGui::Separator();
+	if (!ImGui::CollapsingHeader("MEMORY")) {
+		return;
+	}
+
+	MemoryUsage now;
+	if (memoryUsage) {
+		now = memoryUsage();
+	}
+	if (ImGui::BeginTable("memory", 3,
+        ImGuiTableFlags_SizingFixedFit | ImGuiTableFlags_BordersOuter))
+        {
+		ImGui::TableSetupColumn("Structure");
+		ImGui::TableSetupColumn("MB");
+		ImGui::TableSetupColumn("At load MB");
+		ImGui::TableHeadersRow();
+
+		// structures that only exist now or only existed at load get a dash
+		std::map<std::string, std::pair<long long, long long>> rows;
+		for (const auto &[name, bytes] : now.bytes) {
+			rows[name] = {static_cast<long long>(bytes), -1};
+		}
+		if (memoryReport) {
+			for (const auto &[name, bytes] : memoryReport->steady.bytes) {
+				auto it = rows.emplace(name, std::make_pair(-1LL, 0LL)).first;
+				it->second.second = static_cast<long long>(bytes);
+			}
+		}
+		auto cell = [](long long bytes) {
+			if (bytes < 0) {
+				ImGui::Text("-");
+			} else {
+				ImGui::Text("%.1f", memory::megabytes(bytes));
+			}
+		};
+		for (const auto &[name, bytes] : rows) {
+			ImGui::TableNextRow();
+			ImGui::TableSetColumnIndex(0);
+			ImGui::Text("%s", name.c_str());
+			ImGui::TableSetColumnIndex(1);
+			cell(bytes.first);
+			ImGui::TableSetColumnIndex(2);
+			cell(bytes.second);
+		}
+		ImGui::TableNextRow();
+		ImGui::TableSetColumnIndex(0);
+		ImGui::Text("total");
+		ImGui::TableSetColumnIndex(1);
+		cell(memoryUsage ? static_cast<long long>(now.total()) : -1);
+		ImGui::TableSetColumnIndex(2);
+		cell(memoryReport
+			? static_cast<long long>(memoryReport->steady.total()) : -1);
+
+		ImGui::EndTable();
+	}
+
+	size_t resident = memory::resident();
+	if (resident > 0) {
+		ImGui::Text("Resident %.1f MB", memory::megabytes(resident));
+	}
+	if (memoryReport && memoryReport->peak_resident > 0) {
+		ImGui::Text("Load: peak %.1f MB, %.1f MB after",
+			memory::megabytes(memoryReport->peak_resident),
+			memory::megabytes(memoryReport->resident_after));
+	}
+}
+
 void GUI::add_float_slider(
         const char* label, float* value, float min, float max) {
     // Left cell (Text)
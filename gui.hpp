@@ -7,7 +7,11 @@
 #include <backends/imgui_impl_glfw.h>
 #include <imgui.h>
 
+#include <functional>
+#include <tuple>
+
 #include "renderer.hpp"
+#include "Memory.hpp"
 
 using namespace wgpu;
 
@@ -23,13 +27,33 @@ public:
         float scrollRate = 1.0f;
 
         uint32_t depth = 0;
-        float min_screen_area = 0.2f;
+        // in percent, the largest projected error of the octree and
+        // cluster cuts
+        float error_threshold = 0.2f;
+        // in percent, the NDC area below which a GridHC cell is drawn
+        // by its coarse representatives
+        float coarse_cell_area = 0.2f;
         float weight_e = 0.0f;
         float weight_w = 0.0f;
         float weight_d = 0.0f;
+        // append the camera of every frame to the path saved on exit
+        bool recordPath = false;
+        // frames of a trace captured with F12
+        uint32_t traceFrames = 60;
+
+        // those the LOD cuts depend on, the sort only on the camera
+        auto cut_tie() const {
+            return std::tie(depth, error_threshold, coarse_cell_area,
+                weight_e, weight_w, weight_d);
+        }
     } params;
 
     ImGuiIO imGuiIo;
+
+    // the structures of the scene, polled while the memory section is open
+    std::function<MemoryUsage()> memoryUsage;
+    // the footprint measured when the scene was loaded
+    const MemoryReport *memoryReport{nullptr};
 private:
     GLFWwindow *window;
     Renderer *renderer;
@@ -43,6 +67,10 @@ public:
     void update(RenderPassEncoder renderPass);
 
 private:
+    // rolling zone timings and counters of the Profiler
+    void add_profiler();
+    // bytes per structure now and after loading, and the resident set
+    void add_memory();
     void add_float_slider(
         const char* label, float* value, float min, float max);
     void add_int_slider(
@@ -0,0 +1,435 @@
+// Replays a camera path over a .splat scene without a window, running the
+// CPU stages of SplatMesh::render for every frame: the LOD cut, the back to
+// front sort and finding the ranges of sort indices to upload. Frames can
+// also be drawn with CpuRasterizer. Writes the per frame timings to
+// <out dir>/frames.csv, a summary to <out dir>/summary.csv, the bytes per
+// structure to <out dir>/memory.csv and the images to
+// <out dir>/frame_<n>.ppm, for tracking the performance from run to run.
+//
+//   Headless <scene.splat> <out dir> [--lod none|octree|hc|gridhc|clusters]
+//       [--path <file> | --frames <n>] [--distance-begin <d>]
+//       [--distance-end <d>] [--pitch <deg>] [--turns <n>] [--fov <deg>]
+//       [--save-path <file>] [--threshold <t>] [--cell-area <a>]
+//       [--depth <d>] [--lazy 0|1] [--render-every <n>] [--width <px>]
+//       [--height <px>]
+//
+// Without --path the camera orbits the scene once while zooming from
+// --distance-begin to --distance-end. --threshold, --cell-area and --depth
+// are the "Error Threshold", "Coarse Cell Area" and "Depth" of the GUI,
+// --lazy 0 uploads the splats of every octree node when loading instead
+// of as they are first drawn and --render-every 0 skips the images.
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <array>
+#include <chrono>
+#include <cstring>
+#include <cstdio>
+#include <algorithm>
+#include <numeric>
+#include <filesystem>
+#include <map>
+
+#include "Splat.h"
+#include "SplatFile.hpp"
+#include "SplatSort.hpp"
+#include "CameraPath.hpp"
+#include "CpuRasterizer.hpp"
+#include "IndexDiff.hpp"
+#include "Octree.hpp"
+#include "HC.hpp"
+#include "GridHC.hpp"
+#include "ClusterLOD.hpp"
+#include "Memory.hpp"
+
+namespace {
+
+struct Settings {
+    std::string lod{"none"};
+    // in percent like the GUI
+    float threshold{0.2f};
+    float cell_area{0.2f};
+    uint32_t depth{0};
+    // the octree merges internal nodes when they first enter a cut
+    bool lazy{true};
+};
+
+// the structures of the SplatMesh variants
+struct Scene {
+    Settings settings;
+    Octree octree;
+    HC hc;
+    GridHC gridhc;
+    ClusterLOD clusters;
+    // the loaded splats until build consumes them, the splatData of the
+    // variant without a LOD structure
+    SplatSplitVector splats_split;
+    SplatVector splats;
+
+    // the splats in the form the LOD structure takes, returns their count
+    size_t load(const std::filesystem::path &path) {
+        if (settings.lod == "octree") {
+            splats_split = load_splats_raw(path, true);
+            return splats_split.size();
+        }
+        splats = load_splats(path, true);
+        return splats.size();
+    }
+
+    // the loadData of the SplatMesh variants, without their debugging crops
+    bool build() {
+        const auto &lod = settings.lod;
+        if (lod == "octree") {
+            octree.build(std::move(splats_split));
+            octree.lazy = settings.lazy;
+            octree.generate();
+        } else if (lod == "hc") {
+            hc.build(std::move(splats));
+        } else if (lod == "gridhc") {
+            gridhc.build(std::move(splats));
+        } else if (lod == "clusters") {
+            gridhc.build(std::move(splats));
+            clusters.build(gridhc);
+            gridhc = GridHC();
+        } else if (lod != "none") {
+            return false;
+        }
+        return true;
+    }
+
+    // SplatMesh::renderSplats of the variant
+    const SplatVector &render_splats() const {
+        const auto &lod = settings.lod;
+        if (lod == "octree") {
+            return octree.splats;
+        }
+        if (lod == "hc") {
+            return hc.splats;
+        }
+        if (lod == "gridhc") {
+            return gridhc.splats;
+        }
+        if (lod == "clusters") {
+            return clusters.splats;
+        }
+        return splats;
+    }
+
+    // the cut of the SplatMesh variants' render, returns the splats to draw
+    // and counts the bytes of splats that would be uploaded for it
+    Indices cut(Camera::Ptr camera, size_t &uploaded_bytes) {
+        const auto &lod = settings.lod;
+        float threshold = settings.threshold * 0.01f;
+        uploaded_bytes = 0;
+        if (lod == "octree") {
+            Indices indices = octree.get_indices(camera, threshold);
+            // the splats of the nodes drawn for the first time
+            uploaded_bytes = ranges_size(octree.take_pending()) * sizeof(Splat);
+            return indices;
+        }
+        if (lod == "hc") {
+            return hc.get_indices_depth(settings.depth);
+        }
+        if (lod == "gridhc") {
+            return gridhc.get_indices_error(
+                camera, settings.depth, settings.cell_area * 0.01f);
+        }
+        if (lod == "clusters") {
+            return clusters.get_indices(camera, threshold);
+        }
+        Indices indices(splats.size());
+        std::iota(indices.begin(), indices.end(), 0);
+        return indices;
+    }
+
+    // SplatMesh::memoryUsage of the variant
+    MemoryUsage memory_usage() const {
+        MemoryUsage usage;
+        usage.add("splatData", splats);
+        const auto &lod = settings.lod;
+        if (lod == "octree") {
+            usage.add(octree.memory_usage());
+        } else if (lod == "hc") {
+            usage.add(hc.memory_usage());
+        } else if (lod == "gridhc" || lod == "clusters") {
+            usage.add(gridhc.memory_usage());
+        }
+        if (lod == "clusters") {
+            usage.add(clusters.memory_usage());
+        }
+        return usage;
+    }
+};
+
+using Clock = std::chrono::steady_clock;
+
+double milliseconds(Clock::time_point start, Clock::time_point end) {
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+struct FrameTimes {
+    size_t splats{0};
+    size_t uploaded_bytes{0};
+    // copies of sort index ranges
+    size_t ranges{0};
+    double cut{0.0};
+    double sort{0.0};
+    double pack{0.0};
+    double render{-1.0};
+};
+
+// value at fraction p of the sorted values
+double percentile(std::vector<double> values, double p) {
+    if (values.empty()) {
+        return 0.0;
+    }
+    std::sort(values.begin(), values.end());
+    size_t i = static_cast<size_t>(p * (values.size() - 1) + 0.5);
+    return values[i];
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        std::cerr << "Usage: " << argv[0]
+                  << " <scene.splat> <out dir> [--lod <lod>] [--path <file>]"
+                  << " [options]" << std::endl;
+        return 1;
+    }
+    std::string scene_path = argv[1];
+    std::filesystem::path out_dir = argv[2];
+
+    Scene scene;
+    CpuRasterizer rasterizer;
+    std::string path_file;
+    std::string save_path;
+    size_t frame_count{120};
+    float distance_begin{5.0f};
+    float distance_end{1.0f};
+    float pitch{0.0f};
+    float turns{1.0f};
+    float fov{45.0f};
+    size_t render_every{0};
+    for (int i = 3; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << arg << std::endl;
+            return 1;
+        }
+        std::string value = argv[++i];
+        if (arg == "--lod") {
+            scene.settings.lod = value;
+        } else if (arg == "--path") {
+            path_file = value;
+        } else if (arg == "--frames") {
+            frame_count = std::stoul(value);
+        } else if (arg == "--distance-begin") {
+            distance_begin = std::stof(value);
+        } else if (arg == "--distance-end") {
+            distance_end = std::stof(value);
+        } else if (arg == "--pitch") {
+            pitch = std::stof(value);
+        } else if (arg == "--turns") {
+            turns = std::stof(value);
+        } else if (arg == "--fov") {
+            fov = std::stof(value);
+        } else if (arg == "--save-path") {
+            save_path = value;
+        } else if (arg == "--threshold") {
+            scene.settings.threshold = std::stof(value);
+        } else if (arg == "--cell-area") {
+            scene.settings.cell_area = std::stof(value);
+        } else if (arg == "--depth") {
+            scene.settings.depth = std::stoul(value);
+        } else if (arg == "--lazy") {
+            scene.settings.lazy = std::stoul(value) != 0;
+        } else if (arg == "--render-every") {
+            render_every = std::stoul(value);
+        } else if (arg == "--width") {
+            rasterizer.params.width = std::stoul(value);
+        } else if (arg == "--height") {
+            rasterizer.params.height = std::stoul(value);
+        } else {
+            std::cerr << "Unknown option " << arg << std::endl;
+            return 1;
+        }
+    }
+
+    CameraPath path;
+    if (!path_file.empty()) {
+        if (!path.load(path_file)) {
+            std::cerr << "Could not load camera path " << path_file << std::endl;
+            return 1;
+        }
+    } else {
+        path = CameraPath::orbit(
+            frame_count, distance_begin, distance_end, pitch, turns, fov);
+    }
+    if (!save_path.empty() && !path.save(save_path)) {
+        std::cerr << "Could not write camera path " << save_path << std::endl;
+        return 1;
+    }
+
+    std::error_code error;
+    std::filesystem::create_directories(out_dir, error);
+    if (error) {
+        std::cerr << "Could not create " << out_dir << std::endl;
+        return 1;
+    }
+
+    MemoryReport memory_report;
+    memory_report.begin();
+    size_t loaded = scene.load(scene_path);
+    if (loaded == 0) {
+        std::cerr << "Could not load splats from " << scene_path << std::endl;
+        return 1;
+    }
+    std::cout << loaded << " splats loaded from " << scene_path << std::endl;
+
+    auto start = Clock::now();
+    if (!scene.build()) {
+        std::cerr << "Unknown LOD " << scene.settings.lod << std::endl;
+        return 1;
+    }
+    double build_time = milliseconds(start, Clock::now());
+    const SplatVector &splats = scene.render_splats();
+    std::cout << "Built " << scene.settings.lod << " with "
+              << splats.size() << " splats in " << build_time
+              << "ms." << std::endl;
+    memory_report.end(scene.memory_usage());
+    memory_report.print(std::cout);
+
+    auto camera = std::make_shared<Camera>();
+    camera->aspect = static_cast<float>(rasterizer.params.width)
+        / rasterizer.params.height;
+
+    // the sort index buffer's contents, only the ranges IndexDiff finds
+    // are copied into it as SplatMesh::uploadIndices does
+    std::vector<uint32_t> staging;
+    IndexDiff index_diff;
+    std::vector<FrameTimes> frames(path.frames.size());
+    for (size_t f = 0; f < path.frames.size(); f++) {
+        path.apply(f, *camera);
+        auto &times = frames[f];
+
+        start = Clock::now();
+        Indices indices = scene.cut(camera, times.uploaded_bytes);
+        auto cut_end = Clock::now();
+        sort_back_to_front(splats, indices,
+            glm::vec3(camera->worldMatrix[3]));
+        auto sort_end = Clock::now();
+        const Ranges &ranges = index_diff.update(indices);
+        staging.resize(indices.size());
+        for (const auto &range : ranges) {
+            std::memcpy(staging.data() + range.begin,
+                indices.data() + range.begin,
+                range.size() * sizeof(uint32_t));
+        }
+        auto pack_end = Clock::now();
+        if (staging != indices) {
+            std::cerr << "Frame " << f << ": the uploaded ranges missed"
+                      << " changed sort indices" << std::endl;
+            return 1;
+        }
+
+        times.splats = indices.size();
+        times.uploaded_bytes += index_diff.changed() * sizeof(uint32_t);
+        times.ranges = ranges.size();
+        times.cut = milliseconds(start, cut_end);
+        times.sort = milliseconds(cut_end, sort_end);
+        times.pack = milliseconds(sort_end, pack_end);
+
+        if (render_every > 0 && f % render_every == 0) {
+            CpuRasterizer::Uniforms uniforms;
+            uniforms.projectionMatrix = camera->getProjectionMatrix();
+            uniforms.viewMatrix = camera->getViewMatrix();
+            start = Clock::now();
+            CpuRasterizer::Image image =
+                rasterizer.render(splats, staging, uniforms);
+            times.render = milliseconds(start, Clock::now());
+
+            char name[32];
+            std::snprintf(name, sizeof(name), "frame_%05zu.ppm", f);
+            if (!image.write_ppm((out_dir / name).string())) {
+                std::cerr << "Could not write " << out_dir / name << std::endl;
+                return 1;
+            }
+        }
+    }
+
+    std::ofstream csv(out_dir / "frames.csv");
+    csv << "frame,splats,uploaded_bytes,ranges,cut_ms,sort_ms,pack_ms,"
+        << "render_ms" << std::endl;
+    for (size_t f = 0; f < frames.size(); f++) {
+        const auto &times = frames[f];
+        csv << f << "," << times.splats << "," << times.uploaded_bytes << ","
+            << times.ranges << "," << times.cut << "," << times.sort << "," << times.pack << ",";
+        if (times.render >= 0.0) {
+            csv << times.render;
+        }
+        csv << std::endl;
+    }
+
+    std::array<std::pair<const char *, double FrameTimes::*>, 4> stages{{
+        {"cut", &FrameTimes::cut},
+        {"sort", &FrameTimes::sort},
+        {"pack", &FrameTimes::pack},
+        {"render", &FrameTimes::render},
+    }};
+    std::ofstream summary(out_dir / "summary.csv");
+    summary << "stage,frames,mean_ms,p50_ms,p95_ms,max_ms" << std::endl;
+    summary << "build,1," << build_time << "," << build_time << ","
+            << build_time << "," << build_time << std::endl;
+    for (const auto &[name, member] : stages) {
+        std::vector<double> values;
+        for (const auto &times : frames) {
+            if (times.*member >= 0.0) {
+                values.push_back(times.*member);
+            }
+        }
+        if (values.empty()) {
+            continue;
+        }
+        double mean = std::accumulate(values.begin(), values.end(), 0.0)
+            / values.size();
+        double p50 = percentile(values, 0.5);
+        double p95 = percentile(values, 0.95);
+        double max = percentile(values, 1.0);
+        summary << name << "," << values.size() << "," << mean << "," << p50
+                << "," << p95 << "," << max << std::endl;
+        std::cout << name << ": mean " << mean << "ms, p50 " << p50
+                  << "ms, p95 " << p95 << "ms, max " << max << "ms over "
+                  << values.size() << " frames." << std::endl;
+    }
+    if (scene.settings.lod == "octree") {
+        std::cout << "Materialized " << scene.octree.materialized_fraction() * 100.0f
+                  << "% of the octree nodes." << std::endl;
+    }
+
+    // the structures after loading and after the last frame, the lazy
+    // octree grows in between; the process rows are resident set sizes
+    MemoryUsage memory_end = scene.memory_usage();
+    std::map<std::string, std::pair<size_t, size_t>> structures;
+    for (const auto &[name, bytes] : memory_report.steady.bytes) {
+        structures[name].first = bytes;
+    }
+    for (const auto &[name, bytes] : memory_end.bytes) {
+        structures[name].second = bytes;
+    }
+    std::ofstream memory_csv(out_dir / "memory.csv");
+    memory_csv << "structure,load_bytes,end_bytes" << std::endl;
+    for (const auto &[name, bytes] : structures) {
+        memory_csv << name << "," << bytes.first << "," << bytes.second
+                   << std::endl;
+    }
+    memory_csv << "total," << memory_report.steady.total() << ","
+               << memory_end.total() << std::endl;
+    memory_csv << "process peak," << memory_report.peak_resident << ","
+               << memory::peak_resident() << std::endl;
+    memory_csv << "process resident," << memory_report.resident_after << ","
+               << memory::resident() << std::endl;
+    return 0;
+}
@@ -0,0 +1,187 @@
+// Checks the ranges IndexDiff finds between consecutive sort indices.
+//
+//   IndexDiffTest
+//
+// Every case copies the ranges of each update into a buffer that mirrors
+// the sort index buffer, which then has to equal the indices, and compares
+// the ranges with those expected. Exits with an error if any case fails.
+
+#include <iostream>
+#include <numeric>
+#include <string>
+
+#include "IndexDiff.hpp"
+
+namespace {
+
+int failures{0};
+
+void check(bool condition, const std::string &name, const std::string &what) {
+    if (!condition) {
+        std::cerr << name << ": " << what << std::endl;
+        failures++;
+    }
+}
+
+std::string to_string(const Ranges &ranges) {
+    std::string out;
+    for (const auto &range : ranges) {
+        out += "[" + std::to_string(range.begin) + ", "
+            + std::to_string(range.end) + ") ";
+    }
+    return out.empty() ? "none" : out;
+}
+
+// updates diff and buffer like SplatMesh::uploadIndices and checks the
+// ranges and the buffer
+void expect(IndexDiff &diff, Indices &buffer, const Indices &indices,
+        const Ranges &expected, const std::string &name) {
+    const auto &ranges = diff.update(indices);
+    if (buffer.size() < indices.size()) {
+        buffer.resize(indices.size());
+    }
+    for (const auto &range : ranges) {
+        std::copy(indices.begin() + range.begin, indices.begin() + range.end,
+            buffer.begin() + range.begin);
+    }
+
+    bool equal = ranges.size() == expected.size();
+    for (size_t i = 0; equal && i < ranges.size(); i++) {
+        equal = ranges[i].begin == expected[i].begin
+            && ranges[i].end == expected[i].end;
+    }
+    check(equal, name, "ranges " + to_string(ranges) + ", expected "
+        + to_string(expected));
+    check(diff.changed() == ranges_size(expected), name,
+        "changed " + std::to_string(diff.changed()));
+    check(std::equal(indices.begin(), indices.end(), buffer.begin()), name,
+        "buffer differs from the indices");
+}
+
+Indices iota(size_t count) {
+    Indices indices(count);
+    std::iota(indices.begin(), indices.end(), 0);
+    return indices;
+}
+
+void test_first_and_equal() {
+    IndexDiff diff;
+    Indices buffer;
+    auto indices = iota(1000);
+    expect(diff, buffer, indices, {{0, 1000}}, "first update");
+    expect(diff, buffer, indices, {}, "equal indices");
+}
+
+void test_merge_gap() {
+    IndexDiff diff;
+    diff.merge_gap = 4;
+    Indices buffer;
+    auto indices = iota(1000);
+    expect(diff, buffer, indices, {{0, 1000}}, "merge gap setup");
+
+    // three equal indices between the changes, fewer than merge_gap
+    indices[10] = 5000;
+    indices[14] = 5001;
+    expect(diff, buffer, indices, {{10, 15}}, "merge gap merged");
+
+    // four equal indices between the changes
+    indices[100] = 5002;
+    indices[105] = 5003;
+    expect(diff, buffer, indices, {{100, 101}, {105, 106}},
+        "merge gap split");
+
+    // a change in the last index
+    indices[999] = 5004;
+    expect(diff, buffer, indices, {{999, 1000}}, "merge gap last");
+}
+
+void test_sizes() {
+    IndexDiff diff;
+    diff.merge_gap = 4;
+    Indices buffer;
+    auto indices = iota(1000);
+    expect(diff, buffer, indices, {{0, 1000}}, "sizes setup");
+
+    // the new indices past the old ones
+    indices.push_back(2000);
+    indices.push_back(2001);
+    expect(diff, buffer, indices, {{1000, 1002}}, "grow");
+
+    // and a change close to them joins their range
+    indices[998] = 3000;
+    indices.push_back(2002);
+    expect(diff, buffer, indices, {{998, 1003}}, "grow merged");
+
+    // the indices past the new size are not drawn and not uploaded
+    indices.resize(500);
+    expect(diff, buffer, indices, {}, "shrink");
+
+    indices.resize(400);
+    indices[0] = 4000;
+    expect(diff, buffer, indices, {{0, 1}}, "shrink changed");
+
+    indices.clear();
+    expect(diff, buffer, indices, {}, "empty");
+}
+
+void test_full_fraction() {
+    IndexDiff diff;
+    diff.merge_gap = 1;
+    diff.full_fraction = 0.25f;
+    Indices buffer;
+    auto indices = iota(100);
+    expect(diff, buffer, indices, {{0, 100}}, "full fraction setup");
+
+    // every fourth index, exactly the fraction
+    for (size_t i = 0; i < 100; i += 4) {
+        indices[i] += 1000;
+    }
+    Ranges quarter;
+    for (uint32_t i = 0; i < 100; i += 4) {
+        quarter.push_back({i, i + 1});
+    }
+    expect(diff, buffer, indices, quarter, "full fraction reached");
+
+    // one more, the collection stops early and everything is uploaded
+    for (size_t i = 0; i < 100; i += 4) {
+        indices[i] += 1000;
+    }
+    indices[99] += 1000;
+    expect(diff, buffer, indices, {{0, 100}}, "full fraction exceeded");
+
+    // growing counts the new indices
+    indices.resize(200, 7);
+    expect(diff, buffer, indices, {{0, 200}}, "full fraction grow");
+    expect(diff, buffer, indices, {}, "full fraction equal");
+}
+
+void test_reset() {
+    IndexDiff diff;
+    Indices buffer;
+    auto indices = iota(1000);
+    expect(diff, buffer, indices, {{0, 1000}}, "reset setup");
+    expect(diff, buffer, indices, {}, "reset equal");
+
+    // e.g. the buffer was recreated, its contents are lost
+    diff.reset();
+    buffer.assign(buffer.size(), 0);
+    expect(diff, buffer, indices, {{0, 1000}}, "reset");
+    expect(diff, buffer, indices, {}, "reset equal again");
+}
+
+} // namespace
+
+int main() {
+    test_first_and_equal();
+    test_merge_gap();
+    test_sizes();
+    test_full_fraction();
+    test_reset();
+
+    if (failures > 0) {
+        std::cerr << failures << " IndexDiff checks failed" << std::endl;
+        return 1;
+    }
+    std::cout << "IndexDiff ok" << std::endl;
+    return 0;
+}
@@ -12,6 +12,7 @@
 #include <iostream>
 #include <cassert>
 #include <vector>
+#include <algorithm>
 
 #include <glm/glm.hpp>
 #include <glm/ext.hpp>
@@ -28,11 +29,15 @@
 #include "Node.h"
 #include "Camera.h"
 #include "OrbitCamera.h"
+#include "CameraPath.hpp"
+#include "Profiler.hpp"
+#include "ViewState.hpp"
 
 #include "SplatMesh.h"
 #include "SplatMeshOctree.hpp"
 #include "SplatMeshHC.hpp"
 #include "SplatMeshGridHC.hpp"
+#include "SplatMeshClusterLOD.hpp"
 
 using namespace wgpu;
 
@@ -43,6 +48,8 @@ public:
 	void Terminate();
 	void MainLoop();
 	bool IsRunning();
+	// writes the next frames as a Chrome trace
+	void CaptureTrace(const std::string &path, size_t frames);
 
 private:
 	struct Uniforms {
@@ -64,12 +71,15 @@ private:
 	void InitializeBindGroups();
 	void InitializeScene();
 	void UpdateScene();
+	// draw the next REDRAW_FRAMES frames, after input or a change of view
+	void RequestRedraw();
 
 // Event handlers for interaction
 private:
 	void onMouseMove(double xpos, double ypos);
     void onMouseButton(int button, int action, [[maybe_unused]] int mods);
     void onScroll([[maybe_unused]] double xoffset, double yoffset);
+	void onKey(int key, int action);
 
 private:
 	// We put here all the variables that are shared between init and main loop
@@ -92,9 +102,14 @@ private:
 		std::make_shared<OrbitCamera>(5.0);
 	std::shared_ptr<Camera> camera = std::make_shared<Camera>();
 	std::shared_ptr<Node> splatNode = std::make_shared<Node>();
+	// camera of the frames rendered while recording
+	CameraPath cameraPath;
+	// traces captured with F12
+	int traceCount = 0;
 
 	//SplatMesh splatMesh;
 	//SplatMeshOctree splatMesh;
+	//SplatMeshClusterLOD splatMesh;
 	SplatMeshGridHC splatMesh;
 
 	// OTHER ----------------------------------------------------------
@@ -105,10 +120,46 @@ private:
 	// time
 	//double time;
 	double deltaTime;
+
+	// frames drawn after the last input so that the GUI settles, it
+	// updates hovering and layout a frame late
+	static constexpr int REDRAW_FRAMES = 3;
+	// longest frame time the input is scaled with, the first frame after
+	// waiting for events would otherwise take the whole wait
+	static constexpr double MAX_INPUT_DELTA_TIME = 0.1;
+	// frames left to draw before waiting for events again
+	int redrawFrames = REDRAW_FRAMES;
+	// the view of the last frame drawn
+	ViewState drawnView;
 };
 
-int main() {
+int main(int argc, char **argv) {
 	Application app;
+	Profiler::get().name_thread("main");
+
+	// --trace <file.json> [--trace-frames <n>] captures from the start on,
+	// the first frame holds the loading
+	std::string tracePath;
+	size_t traceFrames = 60;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (i + 1 >= argc) {
+			std::cerr << "Missing value for " << arg << std::endl;
+			return 1;
+		}
+		std::string value = argv[++i];
+		if (arg == "--trace") {
+			tracePath = value;
+		} else if (arg == "--trace-frames") {
+			traceFrames = std::stoul(value);
+		} else {
+			std::cerr << "Unknown option " << arg << std::endl;
+			return 1;
+		}
+	}
+	if (!tracePath.empty()) {
+		app.CaptureTrace(tracePath, traceFrames);
+	}
 
 	if (!app.Initialize()) {
 		return 1;
@@ -137,11 +188,13 @@ int main() {
 }
 
 void Application::onMouseMove(double xpos, double ypos) {
+	RequestRedraw();
 	orbitCamera->onMouseMove(xpos, ypos, deltaTime);
 }
 
 void Application::onMouseButton(
 		int button, int action, [[maybe_unused]] int mods) {
+	RequestRedraw();
     if (gui.imGuiIo.WantCaptureMouse) {
         // Don't rotate the camera if the mouse is already captured by an ImGui
         // interaction at this frame.
@@ -151,9 +204,24 @@ void Application::onMouseButton(
 }
 
 void Application::onScroll([[maybe_unused]] double xoffset, double yoffset) {
+	RequestRedraw();
 	orbitCamera->onScroll(yoffset, deltaTime);
 }
 
+void Application::onKey(int key, int action) {
+	RequestRedraw();
+	if (key == GLFW_KEY_F12 && action == GLFW_PRESS
+			&& !Profiler::get().capturing()) {
+		CaptureTrace("trace_" + std::to_string(traceCount++) + ".json",
+			gui.params.traceFrames);
+	}
+}
+
+void Application::CaptureTrace(const std::string &path, size_t frames) {
+	Profiler::get().capture(path, frames);
+	std::cout << "Capturing " << frames << " frames to " << path << std::endl;
+}
+
 bool Application::Initialize() {
 	// Open window
 	glfwInit();
@@ -183,6 +251,19 @@ bool Application::Initialize() {
 			glfwGetWindowUserPointer(window));
 		if (that != nullptr) that->onScroll(xoffset, yoffset);
 	});
+	glfwSetKeyCallback(m_window, [](
+			GLFWwindow* window, int key, [[maybe_unused]] int scancode,
+			int action, [[maybe_unused]] int mods) {
+		auto that = reinterpret_cast<Application*>(
+			glfwGetWindowUserPointer(window));
+		if (that != nullptr) that->onKey(key, action);
+	});
+	// the window was uncovered or restored and lost its contents
+	glfwSetWindowRefreshCallback(m_window, [](GLFWwindow* window) {
+		auto that = reinterpret_cast<Application*>(
+			glfwGetWindowUserPointer(window));
+		if (that != nullptr) that->RequestRedraw();
+	});
 	
 	// Create m_renderer
 	m_renderer.init(m_window);
@@ -196,24 +277,55 @@ bool Application::Initialize() {
 	//time = glfwGetTime();
 
 	gui.init(m_window, &m_renderer);
+	gui.memoryUsage = [this] { return splatMesh.memoryUsage(); };
+	gui.memoryReport = &splatMesh.memoryReport;
 
 	return true;
 }
 
 void Application::Terminate() {
+	if (!cameraPath.frames.empty()) {
+		cameraPath.save("camera_path.txt");
+		std::cout << "Saved " << cameraPath.frames.size()
+			<< " camera frames to camera_path.txt" << std::endl;
+	}
 	pipeline.release();
 	glfwDestroyWindow(m_window);
 	glfwTerminate();
 }
 
+void Application::RequestRedraw() {
+	redrawFrames = REDRAW_FRAMES;
+}
+
 void Application::MainLoop() {
 	// Update time
 	gui.imGuiIo = ImGui::GetIO();
-	deltaTime = gui.imGuiIo.DeltaTime;
-	
+	deltaTime = std::min<double>(
+		gui.imGuiIo.DeltaTime, MAX_INPUT_DELTA_TIME);
 
 	//printf("FPS: %f\n", 1.0 / deltaTime);
-	glfwPollEvents();
+	// the last frame is still current while nothing changes, sleep until
+	// there is input instead of drawing it again
+	if (redrawFrames > 0 || Profiler::get().capturing()) {
+		glfwPollEvents();
+	} else {
+#ifdef __EMSCRIPTEN__
+		// the browser calls MainLoop every frame, it must not block
+		glfwPollEvents();
+#else
+		// the callbacks request a redraw, other events, e.g. focus
+		// changes, wake the loop without one
+		glfwWaitEvents();
+#endif
+		if (redrawFrames == 0) {
+			return;
+		}
+	}
+
+	// hand the zones of the last frame to the GUI
+	Profiler::get().end_frame();
+	PROFILE_ZONE("frame");
 
 	// Update the scene
 	UpdateScene();
@@ -234,13 +346,29 @@ void Application::MainLoop() {
 	// Update the orbit camera
 	orbitCamera->orbitRate = gui.params.orbitRate;
 	orbitCamera->scrollRate = gui.params.scrollRate;
+	// Replayed by the Headless driver
+	if (gui.params.recordPath) {
+		cameraPath.record(*camera);
+	}
+
+	// keep drawing while the camera moves or the cut changes, uniforms
+	// only change with input, which requested a redraw already
+	ViewState view(*camera, gui.params);
+	if (view != drawnView) {
+		drawnView = view;
+		RequestRedraw();
+	}
 
 	// Upload the transform matrix to the buffer
 	m_renderer.queue.writeBuffer(
 			transformBuffer, 0, &uniforms, sizeof(Uniforms));
 
 	// Get the next target texture view
-	TextureView targetView = m_renderer.get_next_surface_texture_view();
+	TextureView targetView;
+	{
+		PROFILE_ZONE("acquire surface");
+		targetView = m_renderer.get_next_surface_texture_view();
+	}
 	if (!targetView) return;
 
 	// Create a command encoder for the draw call
@@ -258,9 +386,15 @@ void Application::MainLoop() {
 	// Set binding group here!
 	renderPass.setBindGroup(0, bindGroup, 0, nullptr);
 
-	splatMesh.render(renderPass, camera, gui.params);
+	{
+		PROFILE_ZONE("render splats");
+		splatMesh.render(renderPass, camera, gui.params);
+	}
 
-	gui.update(renderPass);
+	{
+		PROFILE_ZONE("gui");
+		gui.update(renderPass);
+	}
 
 	renderPass.end();
 	renderPass.release();
@@ -272,14 +406,23 @@ void Application::MainLoop() {
 	encoder.release();
 
 	//std::cout << "Submitting command..." << std::endl;
-	m_renderer.queue.submit(1, &command);
+	{
+		PROFILE_ZONE("submit");
+		m_renderer.queue.submit(1, &command);
+	}
 	command.release();
 	//std::cout << "Command submitted." << std::endl;
 
 	// At the end of the frame
 	targetView.release();
+	if (redrawFrames > 0) {
+		redrawFrames--;
+	}
 #ifndef __EMSCRIPTEN__
-	m_renderer.surface.present();
+	{
+		PROFILE_ZONE("present");
+		m_renderer.surface.present();
+	}
 #endif
 
 #if defined(WEBGPU_BACKEND_DAWN)
@@ -380,14 +523,13 @@ void Application::InitializePipeline() {
 	bindingLayouts[1].binding = 1;
 	bindingLayouts[1].visibility = ShaderStage::Vertex;
 	bindingLayouts[1].buffer.type = BufferBindingType::ReadOnlyStorage;
-	bindingLayouts[1].buffer.minBindingSize =
-		splatMesh.splatData.size() * sizeof(Splat);
+	bindingLayouts[1].buffer.minBindingSize = splatMesh.splatBuffer.getSize();
 
 	bindingLayouts[2].binding = 2;
 	bindingLayouts[2].visibility = ShaderStage::Vertex;
 	bindingLayouts[2].buffer.type = BufferBindingType::ReadOnlyStorage;
 	bindingLayouts[2].buffer.minBindingSize =
-		splatMesh.splatData.size() * sizeof(uint32_t);
+		splatMesh.sortIndexBuffer.getSize();
 
 	// Create a bind group layout
 	BindGroupLayoutDescriptor bindGroupLayoutDesc{};
@@ -425,10 +567,16 @@ void Application::InitializeBuffers() {
 
 
 	// Load the splat data
-	splatMesh.loadData(RESOURCE_DIR "/splats/nike.splat", true);
+	splatMesh.load(RESOURCE_DIR "/splats/nike.splat", true);
 	//std::cout << "Loaded " << splatMesh.splatData.size() << " splats" << std::endl;
 
 	splatMesh.initialize(m_renderer.device, m_renderer.queue);
+	// meshes that generate splats on demand reallocate their buffers
+	splatMesh.onBuffersResized = [this](RenderPassEncoder &renderPass) {
+		bindGroup.release();
+		InitializeBindGroups();
+		renderPass.setBindGroup(0, bindGroup, 0, nullptr);
+	};
 
 	// Create a transform uniform buffer
 	BufferDescriptor bufferDesc;
@@ -450,12 +598,12 @@ void Application::InitializeBindGroups() {
 	bindings[1].binding = 1;
 	bindings[1].buffer = splatMesh.splatBuffer;
 	bindings[1].offset = 0;
-	bindings[1].size = splatMesh.splatData.size() * sizeof(Splat);
+	bindings[1].size = splatMesh.splatBuffer.getSize();
 
 	bindings[2].binding = 2;
 	bindings[2].buffer = splatMesh.sortIndexBuffer;
 	bindings[2].offset = 0;
-	bindings[2].size = splatMesh.splatData.size() * sizeof(uint32_t);
+	bindings[2].size = splatMesh.sortIndexBuffer.getSize();
 
 	// A bind group contains one or multiple bindings
 	BindGroupDescriptor bindGroupDesc{};
@@ -0,0 +1,611 @@
+// Benchmarks the splat kernels and the LOD structures over scene sizes and
+// thread counts and writes the results as JSON.
+//
+//   SplatBench [--out <file.json>] [--sizes <n,n,...>] [--threads <n,n,...>]
+//       [--filter <substring>] [--reps <n>] [--min-time <s>] [--seed <n>]
+//       [--distribution uniform|surfaces|multiscale]
+//   SplatBench --validate [--sizes <n,n,...>] [--seed <n>]
+//       [--distribution uniform|surfaces|multiscale]
+//
+// --validate compares the batched kernels of SplatBatch.hpp at every
+// supported SimdLevel with the scalar functions of Splat.h on the scenes of
+// the given sizes instead of timing anything, and fails if they deviate by
+// more than VALIDATE_TOLERANCE.
+//
+// Every benchmark runs once to warm up, then --reps times, each repetition
+// calling it as often as needed to take at least --min-time seconds. The
+// scenes come from SceneGenerator, by default uniform in the unit cube.
+// Thread counts only take effect in PARALLEL builds, where the element wise
+// kernels run as parallel loops.
+//
+// Besides the raw timings the JSON holds a strong scaling table (fixed
+// size, speedup over the fewest threads) and a weak scaling table (the size
+// grows with the threads from the smallest size, efficiency is the time of
+// the fewest threads over the time of n).
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <chrono>
+#include <cmath>
+#include <functional>
+#include <algorithm>
+#include <numeric>
+#include <thread>
+
+#ifdef PARALLEL
+#include <tbb/global_control.h>
+#include <tbb/parallel_for.h>
+#include <tbb/blocked_range.h>
+#endif
+
+#include "Splat.h"
+#include "SplatBatch.hpp"
+#include "SplatSort.hpp"
+#include "SceneGenerator.hpp"
+#include "OrbitCamera.h"
+#include "Octree.hpp"
+#include "HC.hpp"
+#include "GridHC.hpp"
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// f(begin, end) over [0, n), split over the threads in PARALLEL builds
+template <typename F>
+void for_blocks(size_t n, F f) {
+#ifdef PARALLEL
+    tbb::parallel_for(tbb::blocked_range<size_t>(0, n, 4096),
+        [&](const tbb::blocked_range<size_t> &range) {
+            f(range.begin(), range.end());
+        });
+#else
+    f(0, n);
+#endif
+}
+
+// one scene size, the structures are built on first use
+struct Scene {
+    SplatRawVector raw;
+    SplatSplitVector split;
+    SplatVector splats;
+    std::unique_ptr<Octree> octree;
+    std::unique_ptr<HC> hc;
+    std::unique_ptr<GridHC> gridhc;
+    std::vector<Camera::Ptr> cameras;
+
+    Scene(const SceneGenerator &generator) : raw(generator.params.count) {
+        size_t count = raw.size();
+        generator.generate(0, count, raw.data());
+        split.resize(count);
+        splats.resize(count);
+        for (size_t i = 0; i < count; i++) {
+            split[i] = raw_to_split(raw[i]);
+            splats[i] = split_to_splat(split[i]);
+        }
+        // views around the cube, partly inside of it
+        for (int i = 0; i < 8; i++) {
+            OrbitCamera orbit(1.0f + 0.5f * i);
+            orbit.rotate(glm::vec3(0.0f, 1.0f, 0.0f), glm::radians(45.0f * i));
+            orbit.camera->aspect = 1000.0f / 800.0f;
+            orbit.updateWorldMatrix(glm::mat4(1.0f));
+            cameras.push_back(orbit.camera);
+        }
+    }
+
+    Octree &get_octree() {
+        if (!octree) {
+            octree = std::make_unique<Octree>();
+            octree->build(split);
+            octree->generate();
+        }
+        return *octree;
+    }
+
+    HC &get_hc() {
+        if (!hc) {
+            hc = std::make_unique<HC>();
+            hc->build(splats, false);
+        }
+        return *hc;
+    }
+
+    GridHC &get_gridhc() {
+        if (!gridhc) {
+            gridhc = std::make_unique<GridHC>();
+            gridhc->build(splats);
+        }
+        return *gridhc;
+    }
+};
+
+struct Benchmark {
+    std::string name;
+    // returns the function to time, its state lives in the closure
+    std::function<std::function<void()>(Scene &)> prepare;
+};
+
+std::vector<Benchmark> benchmarks() {
+    std::vector<Benchmark> list;
+    list.push_back({"raw_to_split", [](Scene &scene) {
+        auto out = std::make_shared<SplatSplitVector>(scene.raw.size());
+        return [&scene, out] {
+            for_blocks(scene.raw.size(), [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; i++) {
+                    (*out)[i] = raw_to_split(scene.raw[i]);
+                }
+            });
+        };
+    }});
+    list.push_back({"split_to_splat", [](Scene &scene) {
+        auto out = std::make_shared<SplatVector>(scene.split.size());
+        return [&scene, out] {
+            for_blocks(scene.split.size(), [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; i++) {
+                    (*out)[i] = split_to_splat(scene.split[i]);
+                }
+            });
+        };
+    }});
+    // the octree merges up to 8 children
+    list.push_back({"merge", [](Scene &scene) {
+        auto out = std::make_shared<SplatVector>(scene.split.size() / 8);
+        return [&scene, out] {
+            for_blocks(out->size(), [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; i++) {
+                    const SplatSplit *first = scene.split.data() + 8 * i;
+                    (*out)[i] = merge(first, first + 8);
+                }
+            });
+        };
+    }});
+    list.push_back({"merge_splats", [](Scene &scene) {
+        auto out = std::make_shared<SplatVector>(scene.splats.size() / 2);
+        return [&scene, out] {
+            for_blocks(out->size(), [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; i++) {
+                    (*out)[i] = merge_splats(scene.splats[2 * i],
+                        scene.splats[2 * i + 1], 0.5f, 0.5f);
+                }
+            });
+        };
+    }});
+    list.push_back({"kl_divergence", [](Scene &scene) {
+        auto out = std::make_shared<std::vector<float>>(scene.splats.size());
+        return [&scene, out] {
+            size_t n = scene.splats.size();
+            for_blocks(n, [&](size_t begin, size_t end) {
+                for (size_t i = begin; i < end; i++) {
+                    (*out)[i] = kl_divergence(
+                        scene.splats[i], scene.splats[(i + 1) % n]);
+                }
+            });
+        };
+    }});
+    // the batched version HC uses, one splat against all the others
+    list.push_back({"kl_divergence_batch", [](Scene &scene) {
+        auto soa = std::make_shared<SplatSoA>();
+        soa->assign(scene.splats);
+        auto out = std::make_shared<std::vector<float>>(scene.splats.size());
+        return [&scene, soa, out] {
+            kl_divergence_batch(scene.splats.front(), *soa, out->data());
+        };
+    }});
+    list.push_back({"sort", [](Scene &scene) {
+        auto indices = std::make_shared<Indices>(scene.splats.size());
+        return [&scene, indices] {
+            std::iota(indices->begin(), indices->end(), 0);
+            sort_back_to_front(scene.splats, *indices,
+                glm::vec3(scene.cameras.front()->worldMatrix[3]));
+        };
+    }});
+    list.push_back({"octree_build", [](Scene &scene) {
+        return [&scene] {
+            Octree octree;
+            octree.build(scene.split);
+        };
+    }});
+    list.push_back({"octree_generate", [](Scene &scene) {
+        auto &octree = scene.get_octree();
+        return [&octree] {
+            octree.generate();
+        };
+    }});
+    list.push_back({"octree_get_indices", [](Scene &scene) {
+        auto &octree = scene.get_octree();
+        return [&scene, &octree] {
+            for (auto &camera : scene.cameras) {
+                octree.get_indices(camera, 0.002f);
+            }
+        };
+    }});
+    list.push_back({"hc_build", [](Scene &scene) {
+        return [&scene] {
+            HC hc;
+            hc.build(scene.splats, false);
+        };
+    }});
+    list.push_back({"hc_get_indices", [](Scene &scene) {
+        auto &hc = scene.get_hc();
+        return [&scene, &hc] {
+            for (auto &camera : scene.cameras) {
+                hc.get_indices(camera, 1e-5f, {});
+            }
+        };
+    }});
+    list.push_back({"gridhc_build", [](Scene &scene) {
+        return [&scene] {
+            GridHC gridhc;
+            gridhc.build(scene.splats);
+        };
+    }});
+    list.push_back({"gridhc_get_indices", [](Scene &scene) {
+        auto &gridhc = scene.get_gridhc();
+        return [&scene, &gridhc] {
+            for (auto &camera : scene.cameras) {
+                gridhc.get_indices(camera, 1e-5f, {}, 0.002f);
+            }
+        };
+    }});
+    list.push_back({"gridhc_get_indices_error", [](Scene &scene) {
+        auto &gridhc = scene.get_gridhc();
+        return [&scene, &gridhc] {
+            for (auto &camera : scene.cameras) {
+                gridhc.get_indices_error(camera, 1000, 0.002f);
+            }
+        };
+    }});
+    return list;
+}
+
+struct Result {
+    std::string name;
+    size_t size{0};
+    size_t threads{1};
+    size_t iterations{0};
+    // seconds per call over the repetitions
+    std::vector<double> times;
+
+    double min() const {
+        return *std::min_element(times.begin(), times.end());
+    }
+    double median() const {
+        auto sorted = times;
+        std::sort(sorted.begin(), sorted.end());
+        return sorted[sorted.size() / 2];
+    }
+};
+
+Result measure(const std::function<void()> &run, size_t reps, double min_time) {
+    Result result;
+    auto start = Clock::now();
+    run();
+    double once = std::chrono::duration<double>(Clock::now() - start).count();
+    result.iterations = std::max<size_t>(1,
+        static_cast<size_t>(std::ceil(min_time / std::max(once, 1e-9))));
+    for (size_t r = 0; r < reps; r++) {
+        start = Clock::now();
+        for (size_t i = 0; i < result.iterations; i++) {
+            run();
+        }
+        double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+        result.times.push_back(elapsed / result.iterations);
+    }
+    return result;
+}
+
+std::vector<size_t> parse_list(const std::string &value) {
+    std::vector<size_t> list;
+    std::stringstream stream(value);
+    std::string item;
+    while (std::getline(stream, item, ',')) {
+        list.push_back(std::stoul(item));
+    }
+    return list;
+}
+
+// the batched kernels evaluate the formulas in another order and with
+// their own logarithm, but round like the scalar ones otherwise. The merge
+// of two needle like splats far apart has a determinant close to zero, so
+// fused multiply adds alone would already move it far beyond this.
+constexpr double VALIDATE_TOLERANCE{1e-4};
+// splats scored against all of the scene by every kernel
+constexpr size_t VALIDATE_FIRST{64};
+
+// the scalar functions a batched kernel replaces, on a and b[i]
+struct Reference {
+    const char *name;
+    void (*batch)(const Splat &, const SplatSoA &, float *);
+    std::function<float(const Splat &, const Splat &)> scalar;
+};
+
+float merge_error(const Splat &a, const Splat &b) {
+    float w_a = a.weight();
+    float w_b = b.weight();
+    float total_weight = w_a + w_b;
+    w_a /= total_weight;
+    w_b /= total_weight;
+    Splat c = merge_splats(a, b, w_a, w_b);
+    return w_a * splat_divergence(a, c) + w_b * splat_divergence(b, c);
+}
+
+void merge_error_weighted(const Splat &a, const SplatSoA &b, float *out) {
+    merge_error_batch(a, a.weight(), b, out);
+}
+
+// largest deviation of every kernel at every level, relative to the scalar
+// value or absolute below 1. A pair finite in only one of them fails.
+bool validate(const SplatVector &splats) {
+    std::vector<Reference> references{
+        {"kl_divergence_batch", &kl_divergence_batch, kl_divergence},
+        {"sym_kl_divergence_batch", &sym_kl_divergence_batch,
+            sym_kl_divergence},
+        {"splat_divergence_batch", &splat_divergence_batch,
+            splat_divergence},
+        {"merge_error_batch", &merge_error_weighted, merge_error},
+    };
+    SplatSoA soa;
+    soa.assign(splats);
+    std::vector<float> out(splats.size());
+    std::vector<SimdLevel> levels{SimdLevel::Scalar};
+    if (simd_level_supported() >= SimdLevel::AVX2) {
+        levels.push_back(SimdLevel::AVX2);
+    }
+    if (simd_level_supported() >= SimdLevel::AVX512) {
+        levels.push_back(SimdLevel::AVX512);
+    }
+
+    bool valid{true};
+    for (const auto &reference : references) {
+        for (SimdLevel level : levels) {
+            set_simd_level(level);
+            double max_deviation{0.0};
+            size_t compared{0};
+            size_t mismatched{0};
+            size_t first = std::min(VALIDATE_FIRST, splats.size());
+            for (size_t a = 0; a < first; a++) {
+                reference.batch(splats[a], soa, out.data());
+                for (size_t b = 0; b < splats.size(); b++) {
+                    double expected = reference.scalar(splats[a], splats[b]);
+                    if (std::isfinite(expected) != std::isfinite(out[b])) {
+                        mismatched++;
+                    }
+                    if (!std::isfinite(expected) || !std::isfinite(out[b])) {
+                        continue;
+                    }
+                    double deviation = std::abs(out[b] - expected)
+                        / std::max(std::abs(expected), 1.0);
+                    max_deviation = std::max(max_deviation, deviation);
+                    compared++;
+                }
+            }
+            bool passed = max_deviation <= VALIDATE_TOLERANCE
+                && mismatched == 0;
+            valid = valid && passed;
+            std::cerr << reference.name << " " << simd_level_name(level)
+                      << ": max deviation " << max_deviation << " over "
+                      << compared << " pairs, " << mismatched
+                      << " finite in only one"
+                      << (passed ? "" : ", FAILED") << std::endl;
+        }
+    }
+    set_simd_level(simd_level_supported());
+    return valid;
+}
+
+const Result *find(const std::vector<Result> &results,
+        const std::string &name, size_t size, size_t threads) {
+    for (const auto &result : results) {
+        if (result.name == name && result.size == size
+                && result.threads == threads) {
+            return &result;
+        }
+    }
+    return nullptr;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    std::string out_path{"bench.json"};
+    std::vector<size_t> sizes{10000, 40000};
+    std::vector<size_t> threads{1};
+#ifdef PARALLEL
+    for (size_t t = 2; t <= std::thread::hardware_concurrency(); t *= 2) {
+        threads.push_back(t);
+    }
+#endif
+    std::string filter;
+    size_t reps{3};
+    double min_time{0.05};
+    SceneGenerator generator;
+    generator.params.opacity_min = 0;
+    std::string distribution{"uniform"};
+    bool validate_kernels{false};
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--validate") {
+            validate_kernels = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << arg << std::endl;
+            return 1;
+        }
+        std::string value = argv[++i];
+        if (arg == "--out") {
+            out_path = value;
+        } else if (arg == "--sizes") {
+            sizes = parse_list(value);
+        } else if (arg == "--threads") {
+            threads = parse_list(value);
+        } else if (arg == "--filter") {
+            filter = value;
+        } else if (arg == "--reps") {
+            reps = std::max<size_t>(1, std::stoul(value));
+        } else if (arg == "--min-time") {
+            min_time = std::stod(value);
+        } else if (arg == "--seed") {
+            generator.params.seed = std::stoull(value);
+        } else if (arg == "--distribution") {
+            if (!SceneGenerator::parse_distribution(
+                    value, generator.params.distribution)) {
+                std::cerr << "Unknown distribution " << value << std::endl;
+                return 1;
+            }
+            distribution = value;
+        } else {
+            std::cerr << "Unknown option " << arg << std::endl;
+            return 1;
+        }
+    }
+    if (sizes.empty() || threads.empty()) {
+        std::cerr << "Need at least one size and one thread count" << std::endl;
+        return 1;
+    }
+#ifndef PARALLEL
+    threads = {1};
+#endif
+    std::sort(sizes.begin(), sizes.end());
+    std::sort(threads.begin(), threads.end());
+
+    if (validate_kernels) {
+        bool valid{true};
+        for (size_t size : sizes) {
+            generator.params.count = size;
+            Scene scene(generator);
+            std::cerr << "Size " << size << ":" << std::endl;
+            valid = validate(scene.splats) && valid;
+        }
+        return valid ? 0 : 1;
+    }
+
+    // the weak scaling runs give every thread the smallest size's share of
+    // the fewest threads
+    auto weak_size = [&](size_t t) {
+        return sizes.front() * t / threads.front();
+    };
+    std::vector<size_t> weak_sizes;
+    for (size_t t : threads) {
+        size_t size = weak_size(t);
+        if (std::find(sizes.begin(), sizes.end(), size) == sizes.end()) {
+            weak_sizes.push_back(size);
+        }
+    }
+    std::vector<std::pair<size_t, bool>> runs;
+    for (size_t size : sizes) {
+        runs.push_back({size, false});
+    }
+    for (size_t size : weak_sizes) {
+        runs.push_back({size, true});
+    }
+
+    // the builders report their progress on stdout
+    std::stringstream discard;
+    auto *cout_buffer = std::cout.rdbuf();
+
+    auto list = benchmarks();
+    std::vector<Result> results;
+    for (const auto &[size, weak_only] : runs) {
+        generator.params.count = size;
+        Scene scene(generator);
+        for (const auto &benchmark : list) {
+            if (benchmark.name.find(filter) == std::string::npos) {
+                continue;
+            }
+            for (size_t t : threads) {
+                // a weak scaling size only runs with its thread count
+                if (weak_only && weak_size(t) != size) {
+                    continue;
+                }
+#ifdef PARALLEL
+                tbb::global_control control(
+                    tbb::global_control::max_allowed_parallelism, t);
+#endif
+                std::cout.rdbuf(discard.rdbuf());
+                auto run = benchmark.prepare(scene);
+                Result result = measure(run, reps, min_time);
+                std::cout.rdbuf(cout_buffer);
+                discard.str("");
+
+                result.name = benchmark.name;
+                result.size = size;
+                result.threads = t;
+                std::cerr << benchmark.name << " size " << size << " threads "
+                          << t << ": " << result.median() * 1e3 << "ms"
+                          << std::endl;
+                results.push_back(result);
+            }
+        }
+    }
+
+    std::ofstream out(out_path);
+    if (!out.is_open()) {
+        std::cerr << "Could not write " << out_path << std::endl;
+        return 1;
+    }
+    out.precision(9);
+#ifdef PARALLEL
+    const char *parallel = "true";
+#else
+    const char *parallel = "false";
+#endif
+    out << "{\n";
+    out << "  \"parallel\": " << parallel << ",\n";
+    out << "  \"hardware_threads\": " << std::thread::hardware_concurrency() << ",\n";
+    out << "  \"simd\": \"" << simd_level_name(simd_level()) << "\",\n";
+    out << "  \"reps\": " << reps << ",\n";
+    out << "  \"distribution\": \"" << distribution << "\",\n";
+    out << "  \"seed\": " << generator.params.seed << ",\n";
+
+    out << "  \"results\": [";
+    for (size_t i = 0; i < results.size(); i++) {
+        const auto &r = results[i];
+        out << (i ? ",\n" : "\n") << "    {\"benchmark\": \"" << r.name
+            << "\", \"size\": " << r.size << ", \"threads\": " << r.threads
+            << ", \"iterations\": " << r.iterations
+            << ", \"min_s\": " << r.min() << ", \"median_s\": " << r.median()
+            << ", \"splats_per_s\": " << r.size / r.median() << "}";
+    }
+    out << "\n  ],\n";
+
+    out << "  \"strong_scaling\": [";
+    bool first{true};
+    for (const auto &r : results) {
+        const Result *base = find(results, r.name, r.size, threads.front());
+        if (!base || std::find(sizes.begin(), sizes.end(), r.size) == sizes.end()) {
+            continue;
+        }
+        double speedup = base->median() / r.median();
+        out << (first ? "\n" : ",\n") << "    {\"benchmark\": \"" << r.name
+            << "\", \"size\": " << r.size << ", \"threads\": " << r.threads
+            << ", \"speedup\": " << speedup << ", \"efficiency\": "
+            << speedup * threads.front() / r.threads << "}";
+        first = false;
+    }
+    out << "\n  ],\n";
+
+    out << "  \"weak_scaling\": [";
+    first = true;
+    for (const auto &r : results) {
+        if (r.size != weak_size(r.threads)) {
+            continue;
+        }
+        const Result *base = find(results, r.name, sizes.front(), threads.front());
+        if (!base) {
+            continue;
+        }
+        out << (first ? "\n" : ",\n") << "    {\"benchmark\": \"" << r.name
+            << "\", \"size\": " << r.size
+            << ", \"threads\": " << r.threads << ", \"efficiency\": "
+            << base->median() / r.median() << "}";
+        first = false;
+    }
+    out << "\n  ]\n}\n";
+    std::cerr << "Wrote " << results.size() << " results to " << out_path << std::endl;
+    return 0;
+}
@@ -0,0 +1,85 @@
+// Generates a procedural .splat scene with SceneGenerator.
+//
+//   SplatGen [<out.splat>] [--count <n>] [--distribution uniform|surfaces|multiscale]
+//       [--seed <n>] [--extent <e>] [--scale-min <s>] [--scale-max <s>]
+//       [--opacity-min <0-255>] [--opacity-max <0-255>] [--boxes <n>]
+//       [--levels <n>] [--branching <n>] [--ratio <r>]
+//
+// Without an output file the scene is generated into memory as loaded
+// splats, to measure the generator alone.
+
+#include <iostream>
+#include <string>
+#include <chrono>
+
+#include "SceneGenerator.hpp"
+
+int main(int argc, char **argv) {
+    SceneGenerator generator;
+    auto &params = generator.params;
+    std::string out_path;
+    int i = 1;
+    if (argc > 1 && argv[1][0] != '-') {
+        out_path = argv[1];
+        i = 2;
+    }
+    for (; i < argc; i++) {
+        std::string arg = argv[i];
+        if (i + 1 >= argc) {
+            std::cerr << "Missing value for " << arg << std::endl;
+            return 1;
+        }
+        std::string value = argv[++i];
+        if (arg == "--count") {
+            params.count = std::stoull(value);
+        } else if (arg == "--distribution") {
+            if (!SceneGenerator::parse_distribution(value, params.distribution)) {
+                std::cerr << "Unknown distribution " << value << std::endl;
+                return 1;
+            }
+        } else if (arg == "--seed") {
+            params.seed = std::stoull(value);
+        } else if (arg == "--extent") {
+            params.extent = std::stof(value);
+        } else if (arg == "--scale-min") {
+            params.scale_min = std::stof(value);
+        } else if (arg == "--scale-max") {
+            params.scale_max = std::stof(value);
+        } else if (arg == "--opacity-min") {
+            params.opacity_min = std::stoul(value);
+        } else if (arg == "--opacity-max") {
+            params.opacity_max = std::stoul(value);
+        } else if (arg == "--boxes") {
+            params.boxes = std::stoul(value);
+        } else if (arg == "--levels") {
+            params.levels = std::stoul(value);
+        } else if (arg == "--branching") {
+            params.branching = std::stoul(value);
+        } else if (arg == "--ratio") {
+            params.ratio = std::stof(value);
+        } else {
+            std::cerr << "Unknown option " << arg << std::endl;
+            return 1;
+        }
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    size_t bytes{0};
+    if (out_path.empty()) {
+        SplatSplitVector splats = generator.generate_split();
+        bytes = splats.size() * sizeof(SplatSplit);
+    } else {
+        if (!generator.write(out_path)) {
+            std::cerr << "Could not write " << out_path << std::endl;
+            return 1;
+        }
+        bytes = params.count * sizeof(SplatRaw);
+    }
+    auto end = std::chrono::high_resolution_clock::now();
+    std::chrono::duration<double> elapsed = end - start;
+    std::cout << "Generated " << params.count << " splats"
+              << (out_path.empty() ? "" : " to " + out_path) << " in "
+              << elapsed.count() << "s, " << bytes / elapsed.count() / 1e9
+              << " GB/s." << std::endl;
+    return 0;
+}